@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+#
+# Stand-in for a network stream, to exercise the audio thread's stream
+# buffering and reconnects without a real server.
+#
+# Serves one file over HTTP on localhost, honoring Range requests, and
+# misbehaves on request: the first connection can stall, or be dropped,
+# once a number of bytes has gone out.  Every request is logged with the
+# range asked for, so a reconnect that resumes shows up as a request that
+# starts past 0.
+#
+#   scripts/stream-standin.py media/song.mp3 --drop-after 2000000
+#
+# then play http://localhost:8000/ and check:
+#
+#   --stall-after N --stall-for S   the stream buffer drains while stalled,
+#                                   playback goes on until it runs dry,
+#                                   and a stall of more than 5 s reconnects
+#   --drop-after N                  the reconnect asks for a range near
+#                                   where the drop was, not for byte 0
+#   --refuse N                      the next N reconnects are refused, and
+#                                   the retries spread out, doubling
+#
+# Exits non-zero if --drop-after was given and no request resumed past 0.
+
+import argparse
+import os
+import socket
+import sys
+import threading
+import time
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+
+CHUNK = 4096
+
+
+class State(object):
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.connections = 0
+        self.refused = 0
+        self.resumed = False
+        self.last = None
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, fmt, *args):
+        sys.stderr.write('%.3f %s\n' % (time.time(), fmt % args))
+
+    def do_GET(self):
+        state = self.server.state
+        args = state.args
+        size = os.path.getsize(args.path)
+
+        with state.lock:
+            state.connections += 1
+            first = state.connections == 1
+            now = time.time()
+            if state.last is not None:
+                self.log_message('%.1f s since the last request',
+                                 now - state.last)
+            state.last = now
+            refuse = not first and state.refused < args.refuse
+            if refuse:
+                state.refused += 1
+
+        if refuse:
+            self.log_message('refused')
+            self.send_error(503)
+            return
+
+        start = 0
+        ranged = self.headers.get('Range', '')
+        if ranged.startswith('bytes='):
+            start = int(ranged[6:].split('-')[0] or 0)
+        if start > 0:
+            state.resumed = True
+        self.log_message('GET from byte %d of %d', start, size)
+
+        self.send_response(206 if start else 200)
+        self.send_header('Content-Type', args.content_type)
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('Content-Length', str(size - start))
+        if start:
+            self.send_header('Content-Range',
+                             'bytes %d-%d/%d' % (start, size - 1, size))
+        self.end_headers()
+
+        sent = 0
+        stalled = False
+        with open(args.path, 'rb') as f:
+            f.seek(start)
+            while True:
+                data = f.read(CHUNK)
+                if not data:
+                    break
+                if first and args.drop_after and sent >= args.drop_after:
+                    self.log_message('dropping after %d bytes', sent)
+                    self.close_connection = True
+                    self.connection.shutdown(socket.SHUT_RDWR)
+                    return
+                if (first and args.stall_after and not stalled
+                        and sent >= args.stall_after):
+                    self.log_message('stalling for %g s', args.stall_for)
+                    time.sleep(args.stall_for)
+                    stalled = True
+                try:
+                    self.wfile.write(data)
+                except (IOError, OSError):
+                    return
+                sent += len(data)
+                if args.rate:
+                    time.sleep(len(data) / float(args.rate))
+
+
+class Server(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='local stream stand-in')
+    parser.add_argument('path')
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--content-type', default='audio/mpeg')
+    parser.add_argument('--rate', type=int, default=0,
+                        help='bytes per second, 0 for as fast as asked')
+    parser.add_argument('--stall-after', type=int, default=0)
+    parser.add_argument('--stall-for', type=float, default=10.0)
+    parser.add_argument('--drop-after', type=int, default=0)
+    parser.add_argument('--refuse', type=int, default=0)
+    args = parser.parse_args()
+
+    server = Server(('127.0.0.1', args.port), Handler)
+    server.state = State(args)
+    sys.stderr.write('serving %s on http://127.0.0.1:%d/\n'
+                     % (args.path, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+    if args.drop_after and not server.state.resumed:
+        sys.stderr.write('FAIL: no reconnect resumed past byte 0\n')
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
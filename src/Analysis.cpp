@@ -0,0 +1,346 @@
+
+/**
+ * @file Analysis.cpp
+ * @brief shared spectrum analysis implementation
+ */
+
+#include "Analysis.h"
+
+#include "defs.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+#include <QtFMOD/System.h>
+#include <QtFMOD/Channel.h>
+#include <QtFMOD/Sound.h>
+
+#include <QElapsedTimer>
+#include <QDebug>
+
+/**
+ * How much the flux has to exceed its running average to count as an onset.
+ */
+#define ONSET_THRESHOLD 1.5f
+
+/**
+ * Flux below this is never an onset, so silence stays quiet.
+ */
+#define ONSET_MIN_FLUX 0.05f
+
+#define ONSET_GENERATIONS 32
+
+/**
+ * @name beat period bounds
+ *
+ * 200 to 60 bpm, in milliseconds.
+ */
+//@{
+#define BEAT_MIN_PERIOD 300.0
+#define BEAT_MAX_PERIOD 1000.0
+//@}
+
+/**
+ * Mix a freshly read spectrum into the running one.
+ *
+ * Rising values are followed almost immediately, falling values decay over
+ * SPECTRUM_GENERATIONS.
+ */
+void smoothSpectrum (QVector<float>& spectrum,
+                     const QVector<float>& spectrumNew)
+{
+    Q_ASSERT(spectrum.size() == spectrumNew.size());
+
+    float* out = spectrum.data();
+    const float* in = spectrumNew.constData();
+    for (int i = 0; i < spectrum.size(); i++) {
+        expMovAvg(out[i], in[i], in[i] > out[i] ? 1.5 : SPECTRUM_GENERATIONS);
+    }
+}
+
+/**
+ * Reduce @a spectrum to SPECTRUM_BANDS log-spaced bands.
+ *
+ * Each band holds the peak of the bins it covers; every band covers at
+ * least one bin, so the lowest bands map to single bins.
+ */
+void summarizeBands (const QVector<float>& spectrum, QVector<float>& bands)
+{
+    int n = spectrum.size();
+    const float* in = spectrum.constData();
+
+    bands.resize(SPECTRUM_BANDS);
+    float* out = bands.data();
+
+    int lo = 0;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        int edge = int(pow(qreal(n), (b + 1.0) / SPECTRUM_BANDS));
+        int hi = qMin(n, qMax(lo + 1, edge));
+        float peak = 0.0f;
+        for (int i = lo; i < hi; i++) {
+            peak = qMax(peak, in[i]);
+        }
+        out[b] = peak;
+        lo = hi;
+    }
+}
+
+/**
+ * Fill in the features derived from the spectrum of @a frame.
+ *
+ * @param[in,out] frame needs its spectrum set
+ * @param[in] prevSpectrum both channels of the previous hop
+ * @param[in,out] fluxAvg running average of the flux, for onset picking
+ */
+void computeFeatures (AnalysisFrame& frame,
+                      const QVector<float>* prevSpectrum,
+                      float& fluxAvg)
+{
+    frame.loudness = 0.0f;
+    frame.flux = 0.0f;
+    for (int c = 0; c < 2; c++) {
+        const float* cur = frame.spectrum[c].constData();
+        const float* prev = prevSpectrum[c].constData();
+        for (int i = 0; i < frame.spectrum[c].size(); i++) {
+            frame.loudness += cur[i];
+            frame.flux += qMax(0.0f, cur[i] - prev[i]);
+        }
+    }
+
+    frame.onset = pickOnset(frame.flux, fluxAvg);
+}
+
+/**
+ * Whether @a flux stands out from the flux before it.
+ *
+ * @param[in,out] fluxAvg running average of the flux
+ */
+bool pickOnset (float flux, float& fluxAvg)
+{
+    bool onset = flux > fluxAvg * ONSET_THRESHOLD && flux > ONSET_MIN_FLUX;
+    expMovAvg(fluxAvg, flux, ONSET_GENERATIONS);
+    return onset;
+}
+
+/**
+ * Autocorrelates the flux for a range of lags.
+ */
+struct LagScores
+{
+    const float* flux;
+    int n;
+    int minLag;
+    qreal* scores;          ///< per lag, from minLag
+
+    void operator() (int begin, int end)
+    {
+        for (int lag = begin; lag < end; lag++) {
+            qreal score = 0.0;
+            for (int i = 0; i + lag < n; i++) {
+                score += flux[i] * flux[i + lag];
+            }
+            scores[lag - minLag] = score / (n - lag);
+        }
+    }
+};
+
+/**
+ * Find the beat grid that best explains the onset strength of a track.
+ *
+ * Autocorrelates @a flux over the plausible beat periods, then picks the
+ * phase that collects the most flux.
+ *
+ * @param[in] times frame times, in milliseconds
+ * @param[in] flux onset strength per frame
+ * @param[out] period beat period, in milliseconds
+ * @param[out] offset time of the first beat, in milliseconds
+ * @return false if the track is too short
+ */
+bool estimateBeat (const QVector<quint32>& times,
+                   const QVector<float>& flux,
+                   qreal* period, qreal* offset)
+{
+    Q_ASSERT(times.size() == flux.size());
+
+    int n = times.size();
+    if (n < 2) {
+        return false;
+    }
+
+    qreal hop = qreal(times.last() - times.first()) / (n - 1);
+    if (hop <= 0.0) {
+        return false;
+    }
+
+    int minLag = qMax(1, int(BEAT_MIN_PERIOD / hop));
+    int maxLag = int(BEAT_MAX_PERIOD / hop);
+    if (maxLag >= n) {
+        return false;
+    }
+
+    const float* f = flux.constData();
+
+    // the lags are independent, and a whole track makes for a lot of them
+    QVector<qreal> scores (maxLag - minLag + 1);
+    LagScores autocorrelate = { f, n, minLag, scores.data() };
+    parallelFor("beat period", minLag, maxLag + 1, 8, autocorrelate);
+
+    int bestLag = minLag;
+    qreal bestScore = -1.0;
+    for (int lag = minLag; lag <= maxLag; lag++) {
+        if (scores[lag - minLag] > bestScore) {
+            bestScore = scores[lag - minLag];
+            bestLag = lag;
+        }
+    }
+
+    int bestPhase = 0;
+    bestScore = -1.0;
+    for (int phase = 0; phase < bestLag; phase++) {
+        qreal score = 0.0;
+        for (int i = phase; i < n; i += bestLag) {
+            score += f[i];
+        }
+        if (score > bestScore) {
+            bestScore = score;
+            bestPhase = phase;
+        }
+    }
+
+    *period = bestLag * hop;
+    *offset = times.at(bestPhase);
+    return true;
+}
+
+/**
+ * @class HopDecoder
+ *
+ * @brief decodes a track hop by hop, faster than realtime
+ *
+ * Mixes one block per next() through FMOD's non-realtime output, and turns
+ * it into an AnalysisFrame the way the player does: the spectrum of both
+ * channels, smoothed by smoothSpectrum(), with computeFeatures() on top.
+ *
+ * Shared by the lookahead, the feature extractor and the analyzer runner,
+ * so they all see the same frames.
+ */
+
+struct HopDecoder::Private
+{
+    QtFMOD::System fsys;
+    QSharedPointer<QtFMOD::Sound> sound;
+    QSharedPointer<QtFMOD::Channel> channel;
+
+    AnalysisFrame frame;
+    QVector<float> spectrumNew[2];
+    QVector<float> prevSpectrum[2];
+    float fluxAvg;
+
+    Private () :
+        fluxAvg(0.0f)
+    {
+        for (int i = 0; i < 2; i++) {
+            spectrumNew[i].resize(SPECTRUM_LENGTH);
+            frame.spectrum[i].fill(0.0f, SPECTRUM_LENGTH);
+        }
+    }
+};
+
+/**
+ * Open @a url and start decoding it, see isOpen().
+ */
+HopDecoder::HopDecoder (const QString& url) :
+    d(new Private)
+{
+    d->fsys.setOutput(FMOD_OUTPUTTYPE_NOSOUND_NRT);
+    useMappedFiles(&d->fsys, SequentialAccess);
+    d->fsys.init(1);
+
+    d->sound = d->fsys.createStream(url);
+    if (d->fsys.error() != FMOD_OK) {
+        qWarning() << "fmod failed to open" << url;
+        return;
+    }
+
+    d->fsys.playSound(FMOD_CHANNEL_FREE, d->sound, false, d->channel);
+    if (d->fsys.error() != FMOD_OK) {
+        qWarning() << Q_FUNC_INFO << url << d->fsys.errorString();
+        d->channel.clear();
+    }
+}
+
+HopDecoder::~HopDecoder ()
+{
+}
+
+bool HopDecoder::isOpen () const
+{
+    return !d->channel.isNull();
+}
+
+/**
+ * How far the track is decoded, in milliseconds.
+ */
+quint32 HopDecoder::position () const
+{
+    return d->channel->position(FMOD_TIMEUNIT_MS);
+}
+
+/**
+ * Carry on decoding at @a ms, forgetting the smoothing so far.
+ */
+void HopDecoder::seek (quint32 ms)
+{
+    d->frame.spectrum[0].fill(0.0f);
+    d->frame.spectrum[1].fill(0.0f);
+    d->fluxAvg = 0.0f;
+    d->channel->setPosition(ms, FMOD_TIMEUNIT_MS);
+}
+
+/**
+ * Decode the next hop into frame().
+ *
+ * @param[in,out] timings added to, if given
+ * @return false at the end of the track
+ */
+bool HopDecoder::next (HopTimings* timings)
+{
+    QElapsedTimer t;
+
+    // non-realtime output, so this mixes exactly one block
+    t.start();
+    d->fsys.update();
+    if (timings) {
+        timings->decode += t.nsecsElapsed();
+    }
+    if (!d->channel->isPlaying()) {
+        return false;
+    }
+
+    t.start();
+    d->channel->spectrum(d->spectrumNew[0], 0, FMOD_DSP_FFT_WINDOW_RECT);
+    d->channel->spectrum(d->spectrumNew[1], 1, FMOD_DSP_FFT_WINDOW_RECT);
+    d->frame.time = d->channel->position(FMOD_TIMEUNIT_MS);
+    if (timings) {
+        timings->fft += t.nsecsElapsed();
+    }
+
+    t.start();
+    d->prevSpectrum[0] = d->frame.spectrum[0];
+    d->prevSpectrum[1] = d->frame.spectrum[1];
+    smoothSpectrum(d->frame.spectrum[0], d->spectrumNew[0]);
+    smoothSpectrum(d->frame.spectrum[1], d->spectrumNew[1]);
+    computeFeatures(d->frame, d->prevSpectrum, d->fluxAvg);
+    if (timings) {
+        timings->smooth += t.nsecsElapsed();
+    }
+
+    return true;
+}
+
+/**
+ * The hop decoded by the last next().
+ */
+const AnalysisFrame& HopDecoder::frame () const
+{
+    return d->frame;
+}
@@ -0,0 +1,130 @@
+
+/**
+ * @file Analysis.h
+ * @brief shared spectrum analysis definitions
+ */
+
+#pragma once
+
+#include <QVector>
+#include <QList>
+#include <QString>
+#include <QScopedPointer>
+
+/**
+ * Number of spectrum bins per channel.
+ */
+#define SPECTRUM_LENGTH 256
+
+/**
+ * Number of log-spaced bands in a spectrum summary.
+ */
+#define SPECTRUM_BANDS 32
+
+/**
+ * Hops of smoothed spectrum the audio thread keeps for its readers.
+ *
+ * Covers the hops a reader may miss between two looks at the audio state.
+ */
+#define SPECTRUM_HISTORY 16
+
+/**
+ * Number of generations for the falling edge of the spectrum smoothing.
+ */
+#define SPECTRUM_GENERATIONS 8
+
+/**
+ * One analyzed hop of a track.
+ */
+struct AnalysisFrame
+{
+    quint32 time;                   ///< track position, in milliseconds
+    QVector<float> spectrum[2];     ///< smoothed spectrum, per channel
+    float loudness;                 ///< summed spectrum of both channels
+    float flux;                     ///< onset strength
+    bool onset;
+
+    AnalysisFrame () :
+        time(0),
+        loudness(0.0f),
+        flux(0.0f),
+        onset(false)
+    {
+    }
+};
+
+/**
+ * Something that can hand out analysis frames ahead of playback.
+ */
+class AnalysisSource
+{
+public:
+    virtual ~AnalysisSource () { }
+
+    /**
+     * Tell the source where playback is.
+     */
+    virtual void setPlaybackPosition (quint32 ms) { Q_UNUSED(ms); }
+
+    /**
+     * @return time of the newest available frame, or 0 if there is none
+     */
+    virtual quint32 horizon () const = 0;
+
+    /**
+     * The frames in (@a after, @a until], oldest first.
+     */
+    virtual QList<AnalysisFrame> frames (quint32 after,
+                                         quint32 until) const = 0;
+};
+
+void smoothSpectrum (QVector<float>& spectrum,
+                     const QVector<float>& spectrumNew);
+
+void summarizeBands (const QVector<float>& spectrum, QVector<float>& bands);
+
+void computeFeatures (AnalysisFrame& frame,
+                      const QVector<float>* prevSpectrum,
+                      float& fluxAvg);
+
+bool pickOnset (float flux, float& fluxAvg);
+
+bool estimateBeat (const QVector<quint32>& times,
+                   const QVector<float>& flux,
+                   qreal* period, qreal* offset);
+
+/**
+ * Time spent in each stage of HopDecoder::next(), in nanoseconds.
+ */
+struct HopTimings
+{
+    qint64 decode;
+    qint64 fft;
+    qint64 smooth;
+
+    HopTimings () :
+        decode(0),
+        fft(0),
+        smooth(0)
+    {
+    }
+};
+
+class HopDecoder
+{
+public:
+    HopDecoder (const QString& url);
+    ~HopDecoder ();
+
+    bool isOpen () const;
+
+    quint32 position () const;
+    void seek (quint32 ms);
+
+    bool next (HopTimings* timings = NULL);
+    const AnalysisFrame& frame () const;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
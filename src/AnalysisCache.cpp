@@ -0,0 +1,430 @@
+
+/**
+ * @file AnalysisCache.cpp
+ * @brief AnalysisCache implementation
+ */
+
+#include "AnalysisCache.h"
+
+#include "defs.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDesktopServices>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QDebug>
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * Bump whenever the layout below or the meaning of a field changes.
+ */
+#define ANALYSIS_CACHE_VERSION 1
+
+static const char analysisCacheMagic[4] = { 'F', 'W', 'A', 'C' };
+
+/**
+ * @class AnalysisCache
+ *
+ * @brief memory-mapped analysis of a previously decoded track
+ *
+ * The file is a Header, the url it was made from (padded to 4 bytes), and
+ * one CachedFrame per hop.  Everything is stored in native byte order; the
+ * cache is per machine.  The mtime of the source file is part of the key,
+ * so edited files are analyzed again.
+ */
+
+namespace
+{
+
+struct Header
+{
+    char magic[4];
+    quint32 version;
+    qint64 mtime;           ///< source modification time, seconds since epoch
+    quint32 urlSize;        ///< bytes of url, excluding padding
+    quint32 spectrumLength;
+    quint32 frameCount;
+    quint32 onsetCount;
+    float beatPeriod;       ///< milliseconds, 0 if unknown
+    float beatOffset;       ///< milliseconds
+    float loudness;         ///< mean over all frames
+    quint32 reserved;
+};
+
+enum FrameFlag
+{
+    Onset = 0x01
+};
+
+struct CachedFrame
+{
+    quint32 time;
+    float loudness;
+    float flux;
+    quint32 flags;
+    quint8 spectrum[2][SPECTRUM_LENGTH];    ///< sqrt companded, 0..255
+};
+
+inline
+quint32 padded (quint32 size)
+{
+    return (size + 3) & ~3u;
+}
+
+/**
+ * Lookup table to expand companded spectrum values.
+ */
+struct Expander
+{
+    float table[256];
+
+    Expander ()
+    {
+        for (int i = 0; i < 256; i++) {
+            float v = i / 255.0f;
+            table[i] = v * v;
+        }
+    }
+};
+
+inline
+quint8 compand (float v)
+{
+    return quint8(qBound(0.0f, sqrtf(v), 1.0f) * 255.0f + 0.5f);
+}
+
+qint64 sourceMTime (const QUrl& url)
+{
+    // library tracks are stored without a scheme
+    QString path;
+    if (url.scheme().isEmpty()) {
+        path = url.toString();
+    } else if (url.scheme() == "file") {
+        path = url.toLocalFile();
+    }
+    if (path.isEmpty()) {
+        return -1;
+    }
+
+    QFileInfo fileInfo (path);
+    if (!fileInfo.exists()) {
+        return -1;
+    }
+    return fileInfo.lastModified().toTime_t();
+}
+
+} // namespace
+
+struct AnalysisCache::Private
+{
+    QFile file;
+    const Header* header;
+    const CachedFrame* frames;
+
+    Private () :
+        header(NULL),
+        frames(NULL)
+    {
+    }
+
+    int upperBound (quint32 time) const;
+};
+
+AnalysisCache::AnalysisCache (const QUrl& url) :
+    d(new Private)
+{
+    qint64 mtime = sourceMTime(url);
+    if (mtime < 0) {
+        return;
+    }
+
+    d->file.setFileName(fileName(url));
+    if (!d->file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    qint64 size = d->file.size();
+    if (size < qint64(sizeof(Header))) {
+        return;
+    }
+
+    const uchar* map = d->file.map(0, size);
+    if (!map) {
+        qWarning() << Q_FUNC_INFO << d->file.errorString();
+        return;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(map);
+    QByteArray urlBytes (url.toEncoded());
+
+    if (memcmp(header->magic, analysisCacheMagic, 4) != 0
+        || header->version != ANALYSIS_CACHE_VERSION
+        || header->spectrumLength != SPECTRUM_LENGTH
+        || header->mtime != mtime
+        || header->urlSize != quint32(urlBytes.size())) {
+        return;
+    }
+
+    qint64 framesOffset = sizeof(Header) + padded(header->urlSize);
+    qint64 framesSize
+        = qint64(header->frameCount) * qint64(sizeof(CachedFrame));
+    if (size != framesOffset + framesSize
+        || memcmp(map + sizeof(Header), urlBytes.constData(),
+                  urlBytes.size()) != 0) {
+        return;
+    }
+
+    d->header = header;
+    d->frames = reinterpret_cast<const CachedFrame*>(map + framesOffset);
+}
+
+AnalysisCache::~AnalysisCache ()
+{
+}
+
+/**
+ * Where the analysis of @a url lives.
+ */
+QString AnalysisCache::fileName (const QUrl& url)
+{
+    QDir dir (
+        QDesktopServices::storageLocation(QDesktopServices::DataLocation));
+    QByteArray hash (QCryptographicHash::hash(url.toEncoded(),
+                                              QCryptographicHash::Sha1));
+    return dir.filePath(QString("analysis/%0.fwa").arg(hash.toHex().data()));
+}
+
+bool AnalysisCache::isValid () const
+{
+    return d->header != NULL;
+}
+
+quint32 AnalysisCache::horizon () const
+{
+    if (!d->header || d->header->frameCount == 0) {
+        return 0;
+    }
+    return d->frames[d->header->frameCount - 1].time;
+}
+
+/**
+ * Index of the first frame after @a time.
+ */
+int AnalysisCache::Private::upperBound (quint32 time) const
+{
+    int lo = 0;
+    int hi = header->frameCount;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (frames[mid].time <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+QList<AnalysisFrame> AnalysisCache::frames (quint32 after, quint32 until) const
+{
+    static const Expander expander;
+
+    QList<AnalysisFrame> frames;
+    if (!d->header) {
+        return frames;
+    }
+
+    int count = d->header->frameCount;
+    for (int i = d->upperBound(after); i < count; i++) {
+        const CachedFrame& cached = d->frames[i];
+        if (cached.time > until) {
+            break;
+        }
+
+        AnalysisFrame frame;
+        frame.time = cached.time;
+        frame.loudness = cached.loudness;
+        frame.flux = cached.flux;
+        frame.onset = cached.flags & Onset;
+        for (int c = 0; c < 2; c++) {
+            frame.spectrum[c].resize(SPECTRUM_LENGTH);
+            float* out = frame.spectrum[c].data();
+            for (int j = 0; j < SPECTRUM_LENGTH; j++) {
+                out[j] = expander.table[cached.spectrum[c][j]];
+            }
+        }
+        frames << frame;
+    }
+    return frames;
+}
+
+qreal AnalysisCache::beatPeriod () const
+{
+    return d->header ? d->header->beatPeriod : 0.0;
+}
+
+qreal AnalysisCache::beatOffset () const
+{
+    return d->header ? d->header->beatOffset : 0.0;
+}
+
+float AnalysisCache::loudness () const
+{
+    return d->header ? d->header->loudness : 0.0f;
+}
+
+int AnalysisCache::onsetCount () const
+{
+    return d->header ? d->header->onsetCount : 0;
+}
+
+/**
+ * Time of the last analyzed hop, in milliseconds.
+ */
+quint32 AnalysisCache::duration () const
+{
+    return horizon();
+}
+
+/**
+ * @class AnalysisCacheWriter
+ *
+ * @brief streams frames into a new AnalysisCache file
+ *
+ * Frames go to a temporary file as they arrive; commit() fills in the
+ * header and moves it into place.  Without a commit, nothing is left behind.
+ */
+
+struct AnalysisCacheWriter::Private
+{
+    QByteArray url;
+    qint64 mtime;
+    QString fileName;
+    QTemporaryFile file;
+
+    QVector<quint32> times;
+    QVector<float> flux;
+    qreal loudness;
+    quint32 onsetCount;
+
+    Private (const QUrl& url) :
+        url(url.toEncoded()),
+        mtime(sourceMTime(url)),
+        fileName(AnalysisCache::fileName(url)),
+        loudness(0.0),
+        onsetCount(0)
+    {
+    }
+};
+
+AnalysisCacheWriter::AnalysisCacheWriter (const QUrl& url) :
+    d(new Private(url))
+{
+    if (d->mtime < 0) {
+        return;
+    }
+
+    QFileInfo fileInfo (d->fileName);
+    QDir::home().mkpath(fileInfo.path());
+
+    d->file.setFileTemplate(d->fileName + ".XXXXXX");
+    if (!d->file.open()) {
+        qWarning() << Q_FUNC_INFO << d->file.errorString();
+        return;
+    }
+
+    // placeholder, rewritten by commit()
+    Header header;
+    memset(&header, 0, sizeof(header));
+    d->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    QByteArray url (d->url);
+    url.append(QByteArray(padded(url.size()) - url.size(), '\0'));
+    d->file.write(url);
+}
+
+AnalysisCacheWriter::~AnalysisCacheWriter ()
+{
+}
+
+bool AnalysisCacheWriter::isOpen () const
+{
+    return d->file.isOpen();
+}
+
+void AnalysisCacheWriter::append (const AnalysisFrame& frame)
+{
+    if (!isOpen()) {
+        return;
+    }
+
+    CachedFrame cached;
+    cached.time = frame.time;
+    cached.loudness = frame.loudness;
+    cached.flux = frame.flux;
+    cached.flags = frame.onset ? Onset : 0;
+    for (int c = 0; c < 2; c++) {
+        const float* in = frame.spectrum[c].constData();
+        for (int i = 0; i < SPECTRUM_LENGTH; i++) {
+            cached.spectrum[c][i] = compand(in[i]);
+        }
+    }
+    d->file.write(reinterpret_cast<const char*>(&cached), sizeof(cached));
+
+    d->times << frame.time;
+    d->flux << frame.flux;
+    d->loudness += frame.loudness;
+    if (frame.onset) {
+        d->onsetCount++;
+    }
+}
+
+/**
+ * Finish the file and make it visible to readers.
+ */
+bool AnalysisCacheWriter::commit ()
+{
+    if (!isOpen() || d->times.isEmpty()) {
+        return false;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, analysisCacheMagic, 4);
+    header.version = ANALYSIS_CACHE_VERSION;
+    header.mtime = d->mtime;
+    header.urlSize = d->url.size();
+    header.spectrumLength = SPECTRUM_LENGTH;
+    header.frameCount = d->times.size();
+    header.onsetCount = d->onsetCount;
+    header.loudness = d->loudness / d->times.size();
+
+    qreal period, offset;
+    if (estimateBeat(d->times, d->flux, &period, &offset)) {
+        header.beatPeriod = period;
+        header.beatOffset = offset;
+    }
+
+    if (!d->file.seek(0)
+        || d->file.write(reinterpret_cast<const char*>(&header),
+                         sizeof(header)) != qint64(sizeof(header))
+        || !d->file.flush()) {
+        qWarning() << Q_FUNC_INFO << d->file.errorString();
+        return false;
+    }
+
+    QFile::remove(d->fileName);
+    if (!d->file.rename(d->fileName)) {
+        qWarning() << Q_FUNC_INFO << d->file.errorString();
+        return false;
+    }
+    d->file.setAutoRemove(false);
+    d->file.close();
+
+    return true;
+}
@@ -0,0 +1,55 @@
+
+/**
+ * @file AnalysisCache.h
+ * @brief AnalysisCache definition
+ */
+
+#pragma once
+
+#include "Analysis.h"
+
+#include <QScopedPointer>
+#include <QMetaType>
+#include <QUrl>
+
+class AnalysisCache : public AnalysisSource
+{
+public:
+    AnalysisCache (const QUrl& url);
+    virtual ~AnalysisCache ();
+
+    bool isValid () const;
+
+    quint32 horizon () const;
+    QList<AnalysisFrame> frames (quint32 after, quint32 until) const;
+
+    qreal beatPeriod () const;
+    qreal beatOffset () const;
+    float loudness () const;
+    int onsetCount () const;
+    quint32 duration () const;
+
+    static QString fileName (const QUrl& url);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
+
+Q_DECLARE_METATYPE(AnalysisCache*)
+
+class AnalysisCacheWriter
+{
+public:
+    AnalysisCacheWriter (const QUrl& url);
+    ~AnalysisCacheWriter ();
+
+    bool isOpen () const;
+
+    void append (const AnalysisFrame& frame);
+    bool commit ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,161 @@
+/**
+ * @file AnalysisShare.cpp
+ * @brief AnalysisShare implementation
+ */
+
+#include "AnalysisShare.h"
+
+#include "Analysis.h"
+
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include "fyreware-analysis.h"
+
+#include <errno.h>
+#include <time.h>
+
+// frames are copied as is, so the layouts have to agree
+typedef char SpectrumLengthMatches
+    [SPECTRUM_LENGTH == FYREWARE_SHM_SPECTRUM ? 1 : -1];
+typedef char SpectrumBandsMatch[SPECTRUM_BANDS == FYREWARE_SHM_BANDS ? 1 : -1];
+#endif
+
+/**
+ * @class AnalysisShare
+ *
+ * @brief publishes analysis frames to other processes
+ *
+ * Owns the shared memory segment described in fyreware-analysis.h, and
+ * writes one frame into it at a time under a sequence lock.  Writing never
+ * waits on readers.
+ *
+ * Only one instance shares at a time: the segment is created exclusively,
+ * and left alone if it already exists.
+ */
+
+struct AnalysisShare::Private
+{
+#ifdef Q_OS_UNIX
+    fyreware_shm* shm;
+#endif
+    quint32 frame;
+
+    Private () :
+#ifdef Q_OS_UNIX
+        shm(NULL),
+#endif
+        frame(0)
+    {
+    }
+};
+
+AnalysisShare::AnalysisShare () :
+    d(new Private)
+{
+#ifdef Q_OS_UNIX
+    int fd = shm_open(FYREWARE_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        qWarning() << Q_FUNC_INFO << FYREWARE_SHM_NAME
+                   << "is taken by another instance, or was left behind by "
+                      "one that crashed; not sharing the analysis";
+        return;
+    }
+    if (fd < 0) {
+        qWarning() << Q_FUNC_INFO << "shm_open:" << strerror(errno);
+        return;
+    }
+    // the new segment reads as zeroes, and invalid until magic is set
+    if (ftruncate(fd, sizeof(fyreware_shm)) < 0) {
+        qWarning() << Q_FUNC_INFO << "ftruncate:" << strerror(errno);
+        close(fd);
+        shm_unlink(FYREWARE_SHM_NAME);
+        return;
+    }
+    void* ptr = mmap(NULL, sizeof(fyreware_shm), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        qWarning() << Q_FUNC_INFO << "mmap:" << strerror(errno);
+        shm_unlink(FYREWARE_SHM_NAME);
+        return;
+    }
+
+    d->shm = static_cast<fyreware_shm*>(ptr);
+    d->shm->size = sizeof(fyreware_shm);
+    d->shm->version = FYREWARE_SHM_VERSION;
+    __sync_synchronize();
+    d->shm->magic = FYREWARE_SHM_MAGIC;
+#else
+    qWarning() << Q_FUNC_INFO << "shared memory is not supported here";
+#endif
+}
+
+AnalysisShare::~AnalysisShare ()
+{
+#ifdef Q_OS_UNIX
+    if (d->shm) {
+        munmap(d->shm, sizeof(fyreware_shm));
+        shm_unlink(FYREWARE_SHM_NAME);
+    }
+#endif
+}
+
+bool AnalysisShare::isOpen () const
+{
+#ifdef Q_OS_UNIX
+    return d->shm;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Publish @a frame.
+ *
+ * @param[in] bands both channels
+ * @param[in] beatPeriod in milliseconds, 0 if unknown
+ * @param[in] beatPhase 0 on the beat, up to 1
+ */
+void AnalysisShare::write (const AnalysisFrame& frame,
+                           const QVector<float>* bands,
+                           qreal beatPeriod, qreal beatPhase)
+{
+#ifdef Q_OS_UNIX
+    if (!d->shm) {
+        return;
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    fyreware_frame& out = d->shm->frame;
+
+    d->shm->sequence++;
+    __sync_synchronize();
+
+    out.timestamp = quint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+    out.frame = ++d->frame;
+    out.track_time = frame.time;
+    for (int c = 0; c < 2; c++) {
+        memcpy(out.spectrum[c], frame.spectrum[c].constData(),
+               qMin(frame.spectrum[c].size(), SPECTRUM_LENGTH)
+               * sizeof(float));
+        memcpy(out.bands[c], bands[c].constData(),
+               qMin(bands[c].size(), SPECTRUM_BANDS) * sizeof(float));
+    }
+    out.loudness = frame.loudness;
+    out.flux = frame.flux;
+    out.onset = frame.onset;
+    out.beat_period = beatPeriod;
+    out.beat_phase = beatPhase;
+
+    __sync_synchronize();
+    d->shm->sequence++;
+#else
+    Q_UNUSED(frame);
+    Q_UNUSED(bands);
+    Q_UNUSED(beatPeriod);
+    Q_UNUSED(beatPhase);
+#endif
+}
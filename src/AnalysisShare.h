@@ -0,0 +1,27 @@
+/**
+ * @file AnalysisShare.h
+ * @brief AnalysisShare definition
+ */
+
+#pragma once
+
+#include <QVector>
+#include <QScopedPointer>
+
+struct AnalysisFrame;
+
+class AnalysisShare
+{
+public:
+    AnalysisShare ();
+    virtual ~AnalysisShare ();
+
+    bool isOpen () const;
+
+    void write (const AnalysisFrame& frame, const QVector<float>* bands,
+                qreal beatPeriod, qreal beatPhase);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,1115 @@
+
+/**
+ * @file AudioThread.cpp
+ * @brief AudioThread implementation
+ */
+
+#include "AudioThread.moc"
+
+#include "defs.h"
+#include "Analysis.h"
+#include "FeatureExtractor.h"
+#include "TripleBuffer.h"
+#include "VoicePool.h"
+#include "Capture.h"
+#include "MappedFile.h"
+#include "ThreadManager.h"
+
+#include <QtFMOD/System.h>
+#include <QtFMOD/Channel.h>
+#include <QtFMOD/Sound.h>
+#include <QtFMOD/Tag.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QRunnable>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define fsysCheck(fsys)                                                     \
+    do {                                                                    \
+        if ((fsys)->error() != FMOD_OK) {                                   \
+            qWarning() << Q_FUNC_INFO << __LINE__ << (fsys)->errorString(); \
+        }                                                                   \
+    } while (0)
+
+/**
+ * How often the audio thread wakes up.
+ *
+ * In milliseconds.
+ */
+#define AUDIO_PERIOD 5
+
+/**
+ * Channels FMOD mixes.
+ */
+#define CHANNELS 32
+
+/**
+ * Of those, how many sound effect voices get.
+ *
+ * The rest are left for the music streams.
+ */
+#define EFFECT_CHANNELS 24
+
+/**
+ * @name DSP buffer
+ *
+ * FMOD mixes DSP_BUFFER_LENGTH samples at a time, and keeps
+ * DSP_BUFFER_COUNT blocks queued ahead of the output.  Overridden by the
+ * audio/bufferLength and audio/bufferCount settings; live capture wants
+ * them small.
+ */
+//@{
+#define DSP_BUFFER_LENGTH 1024
+#define DSP_BUFFER_COUNT 4
+//@}
+
+/**
+ * Default read-ahead buffer of network streams, in bytes.
+ *
+ * FMOD fills it from its own stream thread.  Overridden by the
+ * stream/bufferSize setting.
+ */
+#define STREAM_BUFFER_SIZE (512 * 1024)
+
+/**
+ * FMOD's own read buffer, kept for local files, in bytes.
+ *
+ * The stream buffer size applies to every stream opened after it is set,
+ * so it is set again before each open.
+ */
+#define FILE_BUFFER_SIZE (16 * 1024)
+
+/**
+ * How full a network stream's buffer has to be before it starts, in percent.
+ */
+#define STREAM_PREFILL 50
+
+/**
+ * How long a network stream can starve before it is reconnected.
+ *
+ * In milliseconds.
+ */
+#define STREAM_STALL_TIMEOUT 5000
+
+/**
+ * @name reconnect backoff
+ *
+ * Wait before reconnecting a network stream, doubled after each try.
+ * In milliseconds.
+ */
+//@{
+#define STREAM_RETRY_MIN 500
+#define STREAM_RETRY_MAX 30000
+//@}
+
+/**
+ * How close to the end of a track the preloaded one gets scheduled.
+ *
+ * It starts on the DSP clock, so this only has to cover an AUDIO_PERIOD
+ * and a mixed block or two ahead of the mixer.  In milliseconds.
+ */
+#define GAPLESS_MARGIN 100
+
+/**
+ * Upper bound on the hops a single analysis run stands in for.
+ */
+#define MAX_COALESCED_HOPS 16
+
+/**
+ * No hop analyzed yet.
+ */
+#define NO_HOP 0xffffffff
+
+/**
+ * How often the tags of the current stream are looked at, in milliseconds.
+ *
+ * Fetching them copies all of them, and only radio streams change them
+ * while playing.
+ */
+#define TAG_CHECK_INTERVAL 1000
+
+/**
+ * @class AudioThread
+ *
+ * @brief owns the FMOD system, its update cadence and the spectrum analysis
+ *
+ * The GUI thread talks to it only through queued commands and reads back an
+ * AudioState through a TripleBuffer, so neither side blocks the other.
+ * The analyzer script still runs on the GUI thread, against the published
+ * spectrum.
+ */
+
+namespace
+{
+
+struct Command
+{
+    enum Type
+    {
+        Play,
+        Preload,
+        TogglePause,
+        Seek,
+        Volume,
+        Listener,
+        Effect,
+        StartCapture
+    };
+
+    Type type;
+    QUrl url;
+    QString name;
+    quint32 ms;
+    float value;
+    btVector3 v[4];
+};
+
+/**
+ * Ask the kernel to start reading a file into the page cache.
+ *
+ * Runs in the worker pool, so neither the GUI nor the audio thread waits on
+ * the disk.
+ */
+class Readahead : public QRunnable
+{
+public:
+    Readahead (const QString& path) :
+        path(path)
+    {
+    }
+
+    void run ()
+    {
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_WILLNEED)
+        int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        ::close(fd);
+#endif
+    }
+
+private:
+    QString path;
+};
+
+/**
+ * Whether @a url is streamed over the network.
+ */
+bool isRemote (const QUrl& url)
+{
+    QString scheme (url.scheme());
+    return scheme == "http" || scheme == "https" || scheme == "mms";
+}
+
+/**
+ * A stream being opened, or open and waiting paused on its channel.
+ */
+struct Track
+{
+    QUrl url;
+    QSharedPointer<QtFMOD::Sound> sound;
+    QSharedPointer<QtFMOD::Channel> channel;
+};
+
+} // namespace
+
+struct AudioThread::Private
+{
+    AudioThread* q;
+
+    QScopedPointer<QtFMOD::System> fsys;
+    QHash<QString, VoicePool*> effects;
+    btVector3 listenerPosition;
+
+    QSharedPointer<QtFMOD::Channel> channel;
+    QSharedPointer<QtFMOD::Sound> sound;
+    QUrl url;                   ///< of sound
+    QSharedPointer<QtFMOD::Channel> previous;   ///< still playing out
+    float volume;
+
+    Track pending;              ///< asked for by play(), starts when open
+    Track next;                 ///< follows the current track gaplessly
+
+    QScopedPointer<Capture> capture;    ///< live input instead of tracks
+
+    unsigned int streamBufferSize;  ///< network read-ahead, in bytes
+    unsigned int streamBuffer;  ///< how full, in percent
+    bool starving;
+    QElapsedTimer starvedFor;
+    bool retrying;              ///< the network stream has to reconnect
+    int retryDelay;             ///< in milliseconds
+    QElapsedTimer retryClock;   ///< since the stream, or a retry, failed
+    quint32 resumeAt;           ///< where a finite stream failed, in ms
+    QElapsedTimer healthyFor;   ///< since the stream last recovered
+    int reconnects;
+
+    quint32 bufferLength;       ///< samples FMOD mixes at a time
+    int bufferCount;            ///< blocks queued ahead of the output
+    int outputRate;             ///< of the software mixer, in Hz
+
+    QVector<float> spectrumNew[2];
+    QVector<float> spectrum[2];
+    QVector<float> bands[2];
+    QVector<float> history;     ///< see AudioState::history
+    quint32 spectrumFrame;
+    quint32 hop;
+
+    QAtomicInt stopped;
+
+    QMutex mutex;
+    QQueue<Command> commands;
+    bool listenerDirty;         ///< latest listener waits in listener
+    Command listener;
+
+    TripleBuffer<AudioState> state;
+
+    QElapsedTimer tagClock;     ///< since the tags were last looked at
+    QString title;
+    QString artist;
+
+    bool anchored;              ///< anchorClock and anchorPcm are set
+    quint64 anchorClock;        ///< DSP clock when the channel was at...
+    quint32 anchorPcm;          ///< ...this position, in samples
+    float mixLead;              ///< mean mixer lead on the position, in ms
+    quint64 lastClock;          ///< as of the last measureLatency()
+    QElapsedTimer clockAge;     ///< since lastClock last moved
+    float staleness;            ///< mean clockAge, in milliseconds
+    float extraLatency;         ///< downstream of the sound card
+
+    Private (AudioThread* q) :
+        q(q),
+        listenerPosition(0, 0, 0),
+        volume(1.0f),
+        streamBufferSize(QSettings().value("stream/bufferSize",
+                                           STREAM_BUFFER_SIZE).toUInt()),
+        streamBuffer(100),
+        starving(false),
+        retrying(false),
+        retryDelay(STREAM_RETRY_MIN),
+        resumeAt(0),
+        reconnects(0),
+        bufferLength(QSettings().value("audio/bufferLength",
+                                       DSP_BUFFER_LENGTH).toUInt()),
+        bufferCount(QSettings().value("audio/bufferCount",
+                                      DSP_BUFFER_COUNT).toInt()),
+        outputRate(0),
+        spectrumFrame(0),
+        hop(NO_HOP),
+        stopped(0),
+        listenerDirty(false),
+        anchored(false),
+        anchorClock(0),
+        anchorPcm(0),
+        mixLead(0.0f),
+        lastClock(0),
+        staleness(0.0f),
+        extraLatency(QSettings().value("audio/extraLatency", 0).toFloat())
+    {
+        clockAge.start();
+        for (int i = 0; i < 2; i++) {
+            spectrumNew[i].resize(SPECTRUM_LENGTH);
+            spectrum[i].fill(0.0f, SPECTRUM_LENGTH);
+            bands[i].fill(0.0f, SPECTRUM_BANDS);
+        }
+        history.fill(0.0f, SPECTRUM_HISTORY * SPECTRUM_LENGTH * 2);
+    }
+
+    /**
+     * How long a mixed block waits before it is heard, in milliseconds.
+     */
+    float bufferLatency () const
+    {
+        return outputRate ? 1000.0f * bufferLength * bufferCount / outputRate
+            : 0.0f;
+    }
+
+    /**
+     * Output samples FMOD has mixed so far.
+     */
+    quint64 dspClock () const
+    {
+        unsigned int hi = 0;
+        unsigned int lo = 0;
+        fsys->dspClock(&hi, &lo);
+        return (quint64(hi) << 32) | lo;
+    }
+
+    void post (const Command& cmd);
+
+    void execute (const Command& cmd);
+    void open (Track& track, const QUrl& url);
+    bool ready (Track& track);
+    void start (Track& track, bool cut);
+    void advance ();
+    void watchStream ();
+    void analyze ();
+    void keepHistory (quint32 frame);
+    void measureLatency ();
+    void checkTags ();
+    void publish ();
+};
+
+AudioThread::AudioThread (QObject* parent) :
+    QThread(parent),
+    d(new Private(this))
+{
+}
+
+AudioThread::~AudioThread ()
+{
+    stop();
+    wait();
+}
+
+/**
+ * @warning any thread
+ */
+void AudioThread::Private::post (const Command& cmd)
+{
+    QMutexLocker locker (&mutex);
+    commands.enqueue(cmd);
+}
+
+void AudioThread::play (const QUrl& url)
+{
+    Command cmd;
+    cmd.type = Command::Play;
+    cmd.url = url;
+    d->post(cmd);
+}
+
+/**
+ * Open @a url ahead of time, to follow the current track without a gap.
+ */
+void AudioThread::preload (const QUrl& url)
+{
+    Command cmd;
+    cmd.type = Command::Preload;
+    cmd.url = url;
+    d->post(cmd);
+}
+
+void AudioThread::togglePause ()
+{
+    Command cmd;
+    cmd.type = Command::TogglePause;
+    d->post(cmd);
+}
+
+void AudioThread::seek (quint32 ms)
+{
+    Command cmd;
+    cmd.type = Command::Seek;
+    cmd.ms = ms;
+    d->post(cmd);
+}
+
+void AudioThread::setVolume (float volume)
+{
+    Command cmd;
+    cmd.type = Command::Volume;
+    cmd.value = volume;
+    d->post(cmd);
+}
+
+/**
+ * Only the most recent listener is kept, this is called every frame.
+ */
+void AudioThread::setListener (const btVector3& position,
+                               const btVector3& velocity,
+                               const btVector3& forward,
+                               const btVector3& up)
+{
+    QMutexLocker locker (&d->mutex);
+    d->listener.type = Command::Listener;
+    d->listener.v[0] = position;
+    d->listener.v[1] = velocity;
+    d->listener.v[2] = forward;
+    d->listener.v[3] = up;
+    d->listenerDirty = true;
+}
+
+/**
+ * @param[in] delay in milliseconds; negative skips into the sample
+ */
+void AudioThread::playEffect (const QString& name, const btVector3& position,
+                              int delay)
+{
+    Command cmd;
+    cmd.type = Command::Effect;
+    cmd.name = name;
+    cmd.v[0] = position;
+    cmd.value = delay;
+    d->post(cmd);
+}
+
+/**
+ * Analyze live input instead of tracks, until the next play().
+ *
+ * @param[in] source empty for the default recording driver, or the path of
+ * a WAV file to stand in for one
+ * @param[in] latency between recording and analysis, in milliseconds
+ */
+void AudioThread::capture (const QString& source, float latency)
+{
+    Command cmd;
+    cmd.type = Command::StartCapture;
+    cmd.name = source;
+    cmd.value = latency;
+    d->post(cmd);
+}
+
+void AudioThread::stop ()
+{
+    d->stopped = 1;
+}
+
+/**
+ * Fetch the newest state published by the audio thread.
+ *
+ * @warning GUI thread only
+ * @return false if nothing changed
+ */
+bool AudioThread::update ()
+{
+    return d->state.update();
+}
+
+/**
+ * @warning GUI thread only
+ */
+const AudioState& AudioThread::state () const
+{
+    return d->state.front();
+}
+
+/**
+ * @warning Runs in its own thread.
+ */
+void AudioThread::run ()
+{
+    if (threadManager) {
+        threadManager->enter(AudioRole, objectName());
+    }
+
+    d->fsys.reset(new QtFMOD::System);
+    d->fsys->setObjectName("fsys");
+
+#ifdef Q_OS_LINUX
+    d->fsys->setOutput(FMOD_OUTPUTTYPE_ALSA);
+#endif
+    fsysCheck(d->fsys);
+
+    // init sound system
+    useMappedFiles(d->fsys.data(), SequentialAccess);
+    d->fsys->setDSPBufferSize(d->bufferLength, d->bufferCount);
+    fsysCheck(d->fsys);
+    d->fsys->init(CHANNELS);
+    fsysCheck(d->fsys);
+    d->fsys->softwareFormat(&d->outputRate);
+    fsysCheck(d->fsys);
+
+    d->fsys->set3DNumListeners(1);
+    d->fsys->set3DSettings(1.0f, 1.0f, 0.3f);
+
+    // sound effects
+    VoicePool* explosions = new VoicePool(d->fsys.data(), "explosion",
+                                          EFFECT_CHANNELS);
+    explosions->setDistance(150, 600);
+    d->effects.insert("explosion", explosions);
+
+    while (!d->stopped) {
+        // take the commands, run them without holding the lock
+        QQueue<Command> commands;
+        {
+            QMutexLocker locker (&d->mutex);
+            commands = d->commands;
+            d->commands.clear();
+            if (d->listenerDirty) {
+                commands.enqueue(d->listener);
+                d->listenerDirty = false;
+            }
+        }
+        while (!commands.isEmpty()) {
+            d->execute(commands.dequeue());
+        }
+
+        d->advance();
+
+        if (d->capture) {
+            d->capture->update();
+            d->channel = d->capture->channel();
+        } else {
+            d->watchStream();
+        }
+
+        foreach (VoicePool* pool, d->effects) {
+            pool->update(d->listenerPosition);
+        }
+
+        d->fsys->update();
+
+        bool running = d->channel && d->channel->isPlaying()
+            && !d->channel->paused();
+
+        // keep background analysis from competing with playback
+        FeatureExtractor::setThrottled(running);
+
+        if (running) {
+            if (!d->capture) {
+                d->measureLatency();
+            }
+            d->analyze();
+        }
+
+        d->publish();
+
+        msleep(AUDIO_PERIOD);
+    }
+
+    d->pending = Track();
+    d->next = Track();
+    d->capture.reset();
+    d->previous.clear();
+    d->channel.clear();
+    d->sound.clear();
+    qDeleteAll(d->effects);
+    d->effects.clear();
+    d->fsys.reset();
+}
+
+/**
+ * @warning audio thread only
+ */
+void AudioThread::Private::execute (const Command& cmd)
+{
+    switch (cmd.type) {
+    case Command::Play:
+        if (next.sound && next.url == cmd.url) {
+            // already open
+            pending = next;
+            next = Track();
+        } else {
+            open(pending, cmd.url);
+        }
+        break;
+    case Command::Preload:
+        if (next.url != cmd.url) {
+            open(next, cmd.url);
+        }
+        break;
+    case Command::TogglePause:
+        if (channel) {
+            channel->setPaused(!channel->paused());
+        }
+        anchored = false;
+        break;
+    case Command::Seek:
+        if (channel && !capture) {
+            channel->setPosition(cmd.ms, FMOD_TIMEUNIT_MS);
+        }
+        anchored = false;
+        break;
+    case Command::Volume:
+        volume = cmd.value;
+        if (channel) {
+            channel->setVolume(volume);
+        }
+        break;
+    case Command::Listener:
+        fsys->set3DListenerAttributes(0, cmd.v[0], cmd.v[1], cmd.v[2],
+                                      cmd.v[3]);
+        listenerPosition = cmd.v[0];
+        break;
+    case Command::Effect:
+        if (VoicePool* pool = effects.value(cmd.name)) {
+            pool->play(cmd.v[0], cmd.value);
+        }
+        break;
+    case Command::StartCapture:
+        if (channel) {
+            channel->stop();
+        }
+        channel.clear();
+        sound.clear();
+        pending = Track();
+        next = Track();
+        capture.reset(new Capture(fsys.data(), cmd.name, cmd.value,
+                                  bufferLength, outputRate));
+        if (!capture->isOpen()) {
+            capture.reset();
+        }
+        hop = NO_HOP;
+        break;
+    }
+}
+
+/**
+ * Start opening @a url into @a track, replacing whatever it held.
+ *
+ * The open is non-blocking, ready() tells when it is done.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::open (Track& track, const QUrl& url)
+{
+    if (track.channel) {
+        track.channel->stop();
+    }
+    track = Track();
+    track.url = url;
+
+    // library tracks are stored without a scheme
+    QString path;
+    if (url.scheme().isEmpty()) {
+        path = url.toString();
+    } else if (url.scheme() == "file") {
+        path = url.toLocalFile();
+    }
+    if (!path.isEmpty()) {
+        threadManager->start(new Readahead(path), WorkerRole);
+    }
+
+    // only network streams get the big read-ahead
+    fsys->setStreamBufferSize(isRemote(url) ? streamBufferSize
+                              : FILE_BUFFER_SIZE, FMOD_TIMEUNIT_RAWBYTES);
+    fsysCheck(fsys);
+    track.sound = fsys->createStream(url.toString(), FMOD_NONBLOCKING);
+    fsysCheck(fsys);
+}
+
+/**
+ * Whether @a track is open and waiting paused on a channel.
+ *
+ * @warning audio thread only
+ */
+bool AudioThread::Private::ready (Track& track)
+{
+    if (!track.sound) {
+        return false;
+    }
+    if (track.channel) {
+        return true;
+    }
+
+    unsigned int buffered = 0;
+    switch (track.sound->openState(&buffered)) {
+    case FMOD_OPENSTATE_READY:
+        if (isRemote(track.url) && buffered < STREAM_PREFILL) {
+            // let the read-ahead fill up first
+            return false;
+        }
+        break;
+    case FMOD_OPENSTATE_ERROR:
+        qWarning() << Q_FUNC_INFO << "failed to open" << track.url;
+        track = Track();
+        return false;
+    default:
+        return false;
+    }
+
+    // paused, so starting it later is only an unpause
+    fsys->playSound(FMOD_CHANNEL_FREE, track.sound, true, track.channel);
+    fsysCheck(fsys);
+    if (!track.channel) {
+        track = Track();
+        return false;
+    }
+    track.channel->setVolume(volume);
+    return true;
+}
+
+/**
+ * Make @a track the current one.
+ *
+ * @param[in] cut stop the current track, rather than let it play out
+ * @warning audio thread only
+ */
+void AudioThread::Private::start (Track& track, bool cut)
+{
+    if (capture) {
+        capture.reset();
+        channel.clear();
+    }
+
+    if (channel) {
+        if (cut) {
+            channel->stop();
+        } else {
+            previous = channel;
+        }
+    }
+
+    if (track.url != url) {
+        retryDelay = STREAM_RETRY_MIN;
+    }
+
+    channel = track.channel;
+    sound = track.sound;
+    url = track.url;
+    track = Track();
+
+    title.clear();
+    artist.clear();
+    tagClock.invalidate();
+
+    starvedFor.invalidate();
+    retrying = false;
+    healthyFor.start();
+
+    channel->setPaused(false);
+    hop = NO_HOP;
+    anchored = false;
+}
+
+/**
+ * Switch tracks when it is time to.
+ *
+ * A track asked for by play() starts as soon as it is open.  Otherwise the
+ * preloaded track is scheduled when the current one is about to end, to
+ * start on the DSP clock sample the current one runs out at.  When nothing
+ * is ready to follow, soundEnded() leaves it to the GUI thread.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::advance ()
+{
+    if (previous && !previous->isPlaying()) {
+        previous.clear();
+    }
+
+    if (ready(pending)) {
+        if (retrying && pending.url == url && resumeAt > 0) {
+            // a reconnected file starts over, pick up where it failed
+            pending.channel->setPosition(resumeAt, FMOD_TIMEUNIT_MS);
+        }
+        start(pending, true);
+        return;
+    }
+
+    if (capture) {
+        return;
+    }
+
+    if (!channel || channel->paused()) {
+        return;
+    }
+
+    bool ended = !channel->isPlaying();
+    if (!ended) {
+        quint32 length = sound->length(FMOD_TIMEUNIT_MS);
+        quint32 position = channel->position(FMOD_TIMEUNIT_MS);
+        if (length == 0xffffffff || position + GAPLESS_MARGIN < length) {
+            // radio, or not near the end yet
+            return;
+        }
+    }
+
+    if (ready(next)) {
+        QUrl url (next.url);
+        quint64 startClock = dspClock();
+        float frequency = channel->frequency();
+        if (!ended && outputRate > 0 && frequency > 0.0f) {
+            // both were read after the last mix, so they line up
+            quint32 length = sound->length(FMOD_TIMEUNIT_PCM);
+            quint32 position = channel->position(FMOD_TIMEUNIT_PCM);
+            if (length > position) {
+                startClock += quint64(quint64(length - position)
+                                      * outputRate / frequency);
+            }
+            next.channel->setDelay(FMOD_DELAYTYPE_DSPCLOCK_START,
+                                   quint32(startClock >> 32),
+                                   quint32(startClock));
+        }
+        start(next, false);
+        anchorClock = startClock;
+        anchorPcm = 0;
+        anchored = true;
+        emit q->trackStarted(url);
+    } else if (ended && !next.sound) {
+        channel.clear();
+        sound.clear();
+        emit q->soundEnded();
+    }
+}
+
+/**
+ * Keep an eye on a network stream, and reconnect it when it fails.
+ *
+ * A stream that errors out or starves for STREAM_STALL_TIMEOUT is opened
+ * again, a delay after it failed.  The delay doubles with every try, and
+ * only drops back once the stream has played without failing for
+ * STREAM_RETRY_MAX.  The old channel keeps going until the new one is
+ * ready, and a stream of finite length resumes where it failed.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::watchStream ()
+{
+    if (!sound || !isRemote(url)) {
+        streamBuffer = 100;
+        starving = false;
+        return;
+    }
+
+    bool failed = false;
+    if (!retrying) {
+        FMOD_OPENSTATE openState = sound->openState(&streamBuffer, &starving);
+        if (starving) {
+            if (!starvedFor.isValid()) {
+                starvedFor.start();
+            }
+        } else {
+            starvedFor.invalidate();
+        }
+        failed = openState == FMOD_OPENSTATE_ERROR
+            || (starvedFor.isValid()
+                && starvedFor.elapsed() > STREAM_STALL_TIMEOUT);
+    }
+
+    if (failed) {
+        qWarning() << Q_FUNC_INFO << url << "stalled, reconnecting";
+        retrying = true;
+        retryClock.start();
+        quint32 length = sound->length(FMOD_TIMEUNIT_MS);
+        resumeAt = length == 0xffffffff ? 0
+            : channel->position(FMOD_TIMEUNIT_MS);
+        return;
+    }
+
+    if (!retrying) {
+        if (!starving && healthyFor.elapsed() > STREAM_RETRY_MAX) {
+            retryDelay = STREAM_RETRY_MIN;
+        }
+        return;
+    }
+
+    if (pending.sound) {
+        // still reconnecting
+        return;
+    }
+    if (!retryClock.isValid()) {
+        // the last try failed to open
+        retryClock.start();
+    }
+    if (retryClock.elapsed() >= retryDelay) {
+        open(pending, url);
+        reconnects++;
+        retryDelay = qMin(retryDelay * 2, STREAM_RETRY_MAX);
+        retryClock.invalidate();
+    }
+}
+
+/**
+ * Read and smooth the spectrum, once per mixed block.
+ *
+ * Blocks missed while the thread was descheduled are coalesced: the
+ * smoothing is stepped once per missed block with the newest spectrum,
+ * which keeps its rate tied to the audio.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::analyze ()
+{
+    quint32 newHop = channel->position(FMOD_TIMEUNIT_PCM) / bufferLength;
+    if (newHop == hop) {
+        return;
+    }
+
+    int hops = 1;
+    if (newHop > hop) {
+        hops = qMin(newHop - hop, quint32(MAX_COALESCED_HOPS));
+    }
+    hop = newHop;
+
+    channel->spectrum(spectrumNew[0], 0, FMOD_DSP_FFT_WINDOW_RECT);
+    channel->spectrum(spectrumNew[1], 1, FMOD_DSP_FFT_WINDOW_RECT);
+
+    for (int i = 0; i < hops; i++) {
+        smoothSpectrum(spectrum[0], spectrumNew[0]);
+        smoothSpectrum(spectrum[1], spectrumNew[1]);
+        keepHistory(spectrumFrame + i + 1);
+    }
+    summarizeBands(spectrum[0], bands[0]);
+    summarizeBands(spectrum[1], bands[1]);
+    spectrumFrame += hops;
+
+    checkTags();
+}
+
+/**
+ * Keep the spectrum as that of hop @a frame in the history.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::keepHistory (quint32 frame)
+{
+    float* out = history.data()
+        + (frame % SPECTRUM_HISTORY) * SPECTRUM_LENGTH * 2;
+    const float* in0 = spectrum[0].constData();
+    const float* in1 = spectrum[1].constData();
+    for (int i = 0; i < SPECTRUM_LENGTH; i++) {
+        *out++ = in0[i];
+        *out++ = in1[i];
+    }
+}
+
+/**
+ * Measure how far the channel position is from what is heard.
+ *
+ * The DSP clock and the channel position are read together.  From an
+ * anchor taken while the channel plays, the mixer should have moved on as
+ * far as the channel did, at the output rate; whatever it is ahead of that
+ * is mixed but not yet reflected in the position.  A mixed block is then
+ * heard bufferLatency() later, less the time since the clock last moved.
+ *
+ * FMOD Ex does not tell where the sound card is at, so the queue itself is
+ * taken at its nominal depth.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::measureLatency ()
+{
+    quint64 clock = dspClock();
+    quint32 pcm = channel->position(FMOD_TIMEUNIT_PCM);
+    float frequency = channel->frequency();
+    if (outputRate <= 0 || frequency <= 0.0f) {
+        return;
+    }
+
+    if (clock != lastClock) {
+        lastClock = clock;
+        clockAge.restart();
+    }
+    expMovAvg(staleness, float(clockAge.elapsed()), 200);
+
+    if (anchored && clock < anchorClock) {
+        // scheduled, not started yet
+        return;
+    }
+
+    qint64 lead = 0;
+    if (anchored && pcm >= anchorPcm) {
+        lead = qint64(clock - anchorClock)
+            - qint64((pcm - anchorPcm) * outputRate / frequency);
+    }
+    if (!anchored || pcm < anchorPcm
+        || qAbs(lead) > qint64(bufferLength) * bufferCount) {
+        // started, moved or starved since; only the drift from here counts
+        anchorClock = clock;
+        anchorPcm = pcm;
+        anchored = true;
+        return;
+    }
+    expMovAvg(mixLead, 1000.0f * lead / outputRate, 200);
+}
+
+/**
+ * Hand the current state to the GUI thread.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::publish ()
+{
+    AudioState& out = state.back();
+
+    out.open = !channel.isNull();
+    out.playing = channel && channel->isPlaying();
+    out.paused = channel && channel->paused();
+    out.capturing = !capture.isNull();
+    out.streamBuffer = streamBuffer;
+    out.starving = starving;
+    out.reconnects = reconnects;
+    out.volume = volume;
+    if (capture) {
+        // the room hears the input before we get to analyze it
+        out.position = capture->time();
+        out.length = 0xffffffff;
+        out.outputLatency = -capture->latency();
+    } else {
+        out.position = channel ? channel->position(FMOD_TIMEUNIT_MS) : 0;
+        out.length = sound ? sound->length(FMOD_TIMEUNIT_MS) : 0;
+        out.outputLatency = bufferLatency() + mixLead + extraLatency
+            - staleness;
+    }
+
+    out.realVoices = 0;
+    out.virtualVoices = 0;
+    foreach (VoicePool* pool, effects) {
+        out.realVoices += pool->realVoices();
+        out.virtualVoices += pool->virtualVoices();
+    }
+
+    out.title = title;
+    out.artist = artist;
+
+    // shares the data, the next smoothing step detaches
+    out.spectrumFrame = spectrumFrame;
+    for (int i = 0; i < 2; i++) {
+        out.spectrum[i] = spectrum[i];
+        out.bands[i] = bands[i];
+    }
+    out.history = history;
+
+    state.publish();
+}
+
+static inline
+QString findTag (const QHash<QString, QtFMOD::Tag>& tags,
+                 const char* const* names)
+{
+    for (; *names; names++) {
+        if (tags.contains(*names)) {
+            return tags[*names].value().toString();
+        }
+    }
+    return QString();
+}
+
+/**
+ * Pick up the title and artist, at most every TAG_CHECK_INTERVAL.
+ *
+ * @warning audio thread only
+ */
+void AudioThread::Private::checkTags ()
+{
+    if (!sound
+        || (tagClock.isValid() && tagClock.elapsed() < TAG_CHECK_INTERVAL)) {
+        return;
+    }
+    tagClock.start();
+
+    int nbUpdated;
+    QHash<QString, QtFMOD::Tag> tags (sound->tags(&nbUpdated));
+    if (nbUpdated == 0) {
+        return;
+    }
+    QHashIterator<QString, QtFMOD::Tag> tagIter (tags);
+    while (tagIter.hasNext()) {
+        tagIter.next();
+        QtFMOD::Tag tag (tagIter.value());
+        if (tag.updated()) {
+            qDebug().nospace()
+                << qPrintable(tagIter.key()) << ": "
+                << qPrintable(tag.value().toString());
+        }
+    }
+
+    static const char* const titleTags[] = { "TITLE", "TIT2", "TT2", NULL };
+    static const char* const artistTags[] = { "ARTIST", "TPE1", "TP1", NULL };
+    title = findTag(tags, titleTags);
+    artist = findTag(tags, artistTags);
+}
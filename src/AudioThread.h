@@ -0,0 +1,117 @@
+
+/**
+ * @file AudioThread.h
+ * @brief AudioThread definition
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QUrl>
+#include <QVector>
+#include <QString>
+
+#include <LinearMath/btVector3.h>
+
+/**
+ * What the audio thread last saw, as handed to the GUI thread.
+ */
+struct AudioState
+{
+    bool open;                      ///< a stream has been started
+    bool playing;
+    bool paused;
+    bool capturing;                 ///< analyzing live input
+    quint32 position;               ///< in milliseconds
+    quint32 length;                 ///< in milliseconds, ~0 for radio
+    float volume;
+    float outputLatency;            ///< from position to the speakers, in ms
+
+    int streamBuffer;               ///< network read-ahead, in percent full
+    bool starving;                  ///< network stream ran dry
+    int reconnects;                 ///< network stream reconnects so far
+
+    int realVoices;                 ///< sound effects holding a channel
+    int virtualVoices;              ///< sound effects only being timed
+
+    QString title;                  ///< from the stream's tags
+    QString artist;                 ///< from the stream's tags
+
+    quint32 spectrumFrame;          ///< bumped once per analyzed block
+    QVector<float> spectrum[2];     ///< smoothed, per channel
+    QVector<float> bands[2];        ///< summary of spectrum
+    /**
+     * The spectra of the last SPECTRUM_HISTORY hops.
+     *
+     * Hop f is at column f % SPECTRUM_HISTORY; a column holds both channels
+     * interleaved per bin.
+     */
+    QVector<float> history;
+
+    AudioState () :
+        open(false),
+        playing(false),
+        paused(false),
+        capturing(false),
+        position(0),
+        length(0),
+        volume(1.0f),
+        outputLatency(0.0f),
+        streamBuffer(100),
+        starving(false),
+        reconnects(0),
+        realVoices(0),
+        virtualVoices(0),
+        spectrumFrame(0)
+    {
+    }
+};
+
+class AudioThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    AudioThread (QObject* parent = NULL);
+    virtual ~AudioThread ();
+
+    /**
+     * @name commands
+     *
+     * Queued, and carried out by the audio thread.
+     */
+    //@{
+    void play (const QUrl& url);
+    void preload (const QUrl& url);
+    void togglePause ();
+    void seek (quint32 ms);
+    void setVolume (float volume);
+    void setListener (const btVector3& position, const btVector3& velocity,
+                      const btVector3& forward, const btVector3& up);
+    void playEffect (const QString& name, const btVector3& position,
+                     int delay = 0);
+    void capture (const QString& source, float latency);
+    void stop ();
+    //@}
+
+    bool update ();
+    const AudioState& state () const;
+
+signals:
+    /**
+     * The preloaded track took over from the one that ended.
+     */
+    void trackStarted (const QUrl& url);
+
+    /**
+     * The current track ended and nothing was preloaded to follow it.
+     */
+    void soundEnded ();
+
+protected:
+    void run ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
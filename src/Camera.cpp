@@ -30,8 +30,6 @@
 
 #include <QDebug>
 
-#include <qgl.h>
-
 #include <math.h>
 
 struct Camera::Private
@@ -117,14 +115,20 @@ void Camera::lookAt (const btVector3& p)
     mat.getRotation(d->orientation);
 }
 
-void Camera::invoke ()
+/**
+ * Advance the smoothing, once per frame.
+ */
+void Camera::update ()
 {
     expMovAvg(d->smoothedPosition   , d->position   , 8);
     expMovAvg(d->smoothedOrientation, d->orientation, 8);
+}
 
+/**
+ * The modelview transform of the smoothed camera.
+ */
+btTransform Camera::view () const
+{
     btTransform xform (d->smoothedOrientation, d->smoothedPosition);
-    xform = xform.inverse();
-    float m[16];
-    xform.getOpenGLMatrix(m);
-    glMultMatrixf(m);
+    return xform.inverse();
 }
@@ -25,6 +25,7 @@
 
 class btVector3;
 class btQuaternion;
+class btTransform;
 
 class Camera : public QObject
 {
@@ -47,7 +48,8 @@ public:
 
     void lookAt (const btVector3& p);
 
-    virtual void invoke ();
+    virtual void update ();
+    btTransform view () const;
 
 private:
     struct Private;
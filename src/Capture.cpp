@@ -0,0 +1,399 @@
+/**
+ * @file Capture.cpp
+ * @brief Capture implementation
+ */
+
+#include "Capture.h"
+
+#include "defs.h"
+
+#include <QtFMOD/System.h>
+#include <QtFMOD/Channel.h>
+#include <QtFMOD/Sound.h>
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <string.h>
+
+/**
+ * Length of the ring the input is recorded into.
+ *
+ * In milliseconds.
+ */
+#define CAPTURE_RING 1000
+
+/**
+ * Lowest latency allowed between recording and playback.
+ *
+ * Below a couple of milliseconds playback overtakes the recording.
+ */
+#define CAPTURE_MIN_LATENCY 2.0f
+
+/**
+ * Bytes per sample, per channel.
+ */
+#define SAMPLE_SIZE 2
+
+/**
+ * @class Capture
+ *
+ * @brief feeds live input through a channel, for the spectrum analysis
+ *
+ * The input is recorded into a looping sound, which is played latency()
+ * behind the recording, muted.  The channel then looks to the rest of the
+ * audio thread just like a music stream.
+ *
+ * The source is either empty, for the default recording driver, or the
+ * path of a 16 bit PCM WAV file.  The file stands in for a device: it is
+ * written into the ring at real-time pace, and looped.
+ *
+ * @warning audio thread only
+ */
+
+namespace
+{
+
+/**
+ * A 16 bit PCM WAV file, mapped.
+ */
+struct WavFile
+{
+    QFile file;
+    const uchar* data;
+    qint64 size;            ///< of data, in bytes
+    int channels;
+    int rate;
+
+    WavFile (const QString& path) :
+        file(path),
+        data(NULL),
+        size(0),
+        channels(0),
+        rate(0)
+    {
+    }
+
+    bool open ();
+};
+
+quint32 le32 (const uchar* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (quint32(p[3]) << 24);
+}
+
+quint16 le16 (const uchar* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+bool WavFile::open ()
+{
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << Q_FUNC_INFO << file.fileName() << file.errorString();
+        return false;
+    }
+    const uchar* map = file.map(0, file.size());
+    if (!map || file.size() < 12
+        || memcmp(map, "RIFF", 4) || memcmp(map + 8, "WAVE", 4)) {
+        qWarning() << Q_FUNC_INFO << file.fileName() << "is not a WAV file";
+        return false;
+    }
+
+    int bits = 0;
+    qint64 offset = 12;
+    while (offset + 8 <= file.size()) {
+        const uchar* chunk = map + offset;
+        qint64 chunkSize = le32(chunk + 4);
+        if (offset + 8 + chunkSize > file.size()) {
+            chunkSize = file.size() - offset - 8;
+        }
+        if (!memcmp(chunk, "fmt ", 4) && chunkSize >= 16) {
+            if (le16(chunk + 8) != 1) {
+                break;      // not PCM
+            }
+            channels = le16(chunk + 10);
+            rate = le32(chunk + 12);
+            bits = le16(chunk + 22);
+        } else if (!memcmp(chunk, "data", 4)) {
+            data = chunk + 8;
+            size = chunkSize;
+        }
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    if (bits != 8 * SAMPLE_SIZE || channels < 1 || channels > 2
+        || rate <= 0 || !data) {
+        qWarning() << Q_FUNC_INFO << file.fileName()
+                   << "is not a 16 bit mono or stereo PCM WAV file";
+        return false;
+    }
+    size -= size % (channels * SAMPLE_SIZE);
+    return size > 0;
+}
+
+} // namespace
+
+struct Capture::Private
+{
+    QtFMOD::System* fsys;
+    QSharedPointer<QtFMOD::Sound> ring;
+    QSharedPointer<QtFMOD::Channel> channel;
+    quint32 ringLength;         ///< in samples
+    int channels;
+    int rate;
+    float latency;              ///< in milliseconds
+    quint32 latencySamples;
+    quint32 blockLength;        ///< FMOD mixes this many samples at once
+
+    bool device;                ///< recording from the driver
+    QScopedPointer<WavFile> wav;
+    QElapsedTimer wavClock;
+    quint64 written;            ///< samples written from wav
+    qint64 wavOffset;           ///< in bytes
+
+    quint32 playPosition;       ///< as of the last update()
+    quint64 played;             ///< samples played so far
+
+    Private (QtFMOD::System* fsys, float latency, quint32 blockLength) :
+        fsys(fsys),
+        ringLength(0),
+        channels(2),
+        rate(0),
+        latency(qMax(latency, CAPTURE_MIN_LATENCY)),
+        latencySamples(0),
+        blockLength(blockLength),
+        device(false),
+        written(0),
+        wavOffset(0),
+        playPosition(0),
+        played(0)
+    {
+    }
+
+    bool createRing ();
+    quint32 recordPosition ();
+    void feedWav ();
+    void write (quint32 position, const uchar* data, quint32 samples);
+};
+
+/**
+ * @param[in] latency between recording and analysis, in milliseconds
+ * @param[in] blockLength FMOD's DSP buffer length, in samples
+ * @param[in] mixRate FMOD's output rate, which the driver is recorded at
+ */
+Capture::Capture (QtFMOD::System* fsys, const QString& source,
+                  float latency, quint32 blockLength, int mixRate) :
+    d(new Private(fsys, latency, blockLength))
+{
+    if (source.isEmpty()) {
+        d->device = true;
+        d->rate = mixRate;
+    } else {
+        d->wav.reset(new WavFile(source));
+        if (!d->wav->open()) {
+            d->wav.reset();
+            return;
+        }
+        d->channels = d->wav->channels;
+        d->rate = d->wav->rate;
+    }
+
+    if (!d->createRing()) {
+        d->wav.reset();
+        return;
+    }
+
+    if (d->device) {
+        d->fsys->recordStart(0, d->ring, true);
+        if (d->fsys->error() != FMOD_OK) {
+            qWarning() << Q_FUNC_INFO << d->fsys->errorString();
+            d->ring.clear();
+            return;
+        }
+    } else {
+        d->wavClock.start();
+    }
+
+    qDebug() << Q_FUNC_INFO << (d->device ? "recording driver 0" : source)
+             << d->latency << "ms latency";
+}
+
+Capture::~Capture ()
+{
+    if (d->channel) {
+        d->channel->stop();
+    }
+    if (d->device && d->ring) {
+        d->fsys->recordStop(0);
+    }
+}
+
+bool Capture::isOpen () const
+{
+    return !d->ring.isNull();
+}
+
+/**
+ * Keep playback latency() behind the recording.
+ *
+ * Starts playback once enough has been recorded, and jumps back into
+ * place when the two drift apart.  The channel position only moves a
+ * mixed block at a time, so that much slack is allowed.
+ */
+void Capture::update ()
+{
+    if (!d->ring) {
+        return;
+    }
+
+    if (d->wav) {
+        d->feedWav();
+    }
+
+    quint32 record = d->recordPosition();
+
+    if (!d->channel) {
+        if (record < d->latencySamples) {
+            return;
+        }
+        d->fsys->playSound(FMOD_CHANNEL_FREE, d->ring, true, d->channel);
+        if (d->fsys->error() != FMOD_OK || !d->channel) {
+            qWarning() << Q_FUNC_INFO << d->fsys->errorString();
+            return;
+        }
+        // the room already hears the input, this is only for analysis
+        d->channel->setMute(true);
+        d->channel->setPosition(record - d->latencySamples,
+                                FMOD_TIMEUNIT_PCM);
+        d->channel->setPaused(false);
+        d->playPosition = record - d->latencySamples;
+        return;
+    }
+
+    quint32 position = d->channel->position(FMOD_TIMEUNIT_PCM);
+    d->played += (position + d->ringLength - d->playPosition) % d->ringLength;
+    d->playPosition = position;
+
+    quint32 lag = (record + d->ringLength - position) % d->ringLength;
+    if (lag > d->latencySamples + 2 * d->blockLength) {
+        // fell behind, or overtook the recording and wrapped
+        position = (record + d->ringLength - d->latencySamples)
+            % d->ringLength;
+        d->channel->setPosition(position, FMOD_TIMEUNIT_PCM);
+        d->playPosition = position;
+    }
+}
+
+QSharedPointer<QtFMOD::Channel> Capture::channel () const
+{
+    return d->channel;
+}
+
+/**
+ * How much input has been played, in milliseconds.
+ *
+ * Unlike the channel position, this does not wrap with the ring.
+ */
+quint32 Capture::time () const
+{
+    return d->rate ? d->played * 1000 / d->rate : 0;
+}
+
+/**
+ * How long input waits between being recorded and analyzed.
+ *
+ * In milliseconds.
+ */
+float Capture::latency () const
+{
+    return d->latency;
+}
+
+bool Capture::Private::createRing ()
+{
+    ringLength = qint64(rate) * CAPTURE_RING / 1000;
+    latencySamples = qMax(1, qRound(latency * rate / 1000.0f));
+
+    FMOD_CREATESOUNDEXINFO exinfo;
+    memset(&exinfo, 0, sizeof(exinfo));
+    exinfo.cbsize = sizeof(exinfo);
+    exinfo.numchannels = channels;
+    exinfo.format = FMOD_SOUND_FORMAT_PCM16;
+    exinfo.defaultfrequency = rate;
+    exinfo.length = ringLength * channels * SAMPLE_SIZE;
+
+    ring = fsys->createSound(
+        QString(),
+        FMOD_2D | FMOD_SOFTWARE | FMOD_OPENUSER | FMOD_LOOP_NORMAL,
+        &exinfo);
+    if (fsys->error() != FMOD_OK || !ring) {
+        qWarning() << Q_FUNC_INFO << fsys->errorString();
+        ring.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Where the next input sample goes in the ring.
+ */
+quint32 Capture::Private::recordPosition ()
+{
+    if (device) {
+        return fsys->recordPosition(0);
+    }
+    return written % ringLength;
+}
+
+/**
+ * Write as much of the WAV file as is due by now.
+ */
+void Capture::Private::feedWav ()
+{
+    quint64 due = quint64(wavClock.elapsed()) * rate / 1000;
+    if (due <= written) {
+        return;
+    }
+    if (due - written > ringLength) {
+        // fell behind by more than the ring holds, skip ahead
+        written = due - ringLength;
+    }
+    quint32 samples = due - written;
+    int frame = channels * SAMPLE_SIZE;
+
+    while (samples > 0) {
+        quint32 n = qMin(quint64(samples),
+                         quint64(wav->size - wavOffset) / frame);
+        write(written % ringLength, wav->data + wavOffset, n);
+        written += n;
+        samples -= n;
+        wavOffset += qint64(n) * frame;
+        if (wavOffset >= wav->size) {
+            wavOffset = 0;
+        }
+    }
+}
+
+/**
+ * Copy @a samples frames of @a data into the ring at @a position.
+ */
+void Capture::Private::write (quint32 position, const uchar* data,
+                              quint32 samples)
+{
+    int frame = channels * SAMPLE_SIZE;
+    void* ptr1 = NULL;
+    void* ptr2 = NULL;
+    unsigned int len1 = 0;
+    unsigned int len2 = 0;
+    ring->lock(position * frame, samples * frame, &ptr1, &ptr2, &len1, &len2);
+    if (!ptr1) {
+        return;
+    }
+    memcpy(ptr1, data, len1);
+    if (ptr2) {
+        memcpy(ptr2, data + len1, len2);
+    }
+    ring->unlock(ptr1, ptr2, len1, len2);
+}
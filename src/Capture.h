@@ -0,0 +1,36 @@
+/**
+ * @file Capture.h
+ * @brief Capture definition
+ */
+
+#pragma once
+
+#include <QString>
+#include <QScopedPointer>
+#include <QSharedPointer>
+
+namespace QtFMOD
+{
+class System;
+class Channel;
+}
+
+class Capture
+{
+public:
+    Capture (QtFMOD::System* fsys, const QString& source, float latency,
+             quint32 blockLength, int mixRate);
+    virtual ~Capture ();
+
+    bool isOpen () const;
+
+    void update ();
+
+    QSharedPointer<QtFMOD::Channel> channel () const;
+    quint32 time () const;
+    float latency () const;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -9,8 +9,6 @@
 #include "defs.h"
 #include "scripting.h"
 #include "Scene.h"
-#include "ShaderProgram.h"
-#include "Camera.h"
 #include "SoundEngine.h"
 
 #include <QVector>
@@ -20,37 +18,22 @@
 
 #include <Cg/cgGL.h>
 
-#include <QtFMOD/System.h>
-#include <QtFMOD/Channel.h>
-#include <QtFMOD/Sound.h>
 
 struct Cluster::Private
 {
     btVector3 origin;
     QVector<btVector3> initialVelocities;
     qreal lifetime;
-    qreal age;
     QHash<QString, btVector3> colorTable;
     btVector3 color;
     int starCount;
 
-    QSharedPointer<QtFMOD::Channel> channel;
-
     QScriptProgram& shellProgram;
 
-    struct {
-        CGparameter v0;
-        CGparameter t;
-        CGparameter nt;
-        CGparameter origin;
-        CGparameter eye;
-    } shader;
-
     Private (const btVector3& origin, QScriptProgram& shellProgram,
              Cluster* q) :
         origin(origin),
         lifetime(4),
-        age(0.0),
         starCount(0),
         shellProgram(shellProgram)
     {
@@ -65,13 +48,6 @@ Cluster::Cluster (const btVector3& origin, QScriptProgram& shellProgram,
 {
     setup();
 
-    CGprogram prog = scene->shader("fyreworks")->program();
-    d->shader.v0     = cgGetNamedParameter(prog, "v0");
-    d->shader.t      = cgGetNamedParameter(prog, "t");
-    d->shader.nt     = cgGetNamedParameter(prog, "nt");
-    d->shader.origin = cgGetNamedParameter(prog, "origin");
-    d->shader.eye    = cgGetNamedParameter(prog, "eye");
-
     // color
     d->colorTable.insert("red"           , btVector3(1.0f , 0.0f , 0.0f ));
     d->colorTable.insert("orange"        , btVector3(1.0f , 0.6f , 0.0f ));
@@ -86,9 +62,7 @@ Cluster::Cluster (const btVector3& origin, QScriptProgram& shellProgram,
     d->color = colors[floor(randf(colors.size()))];
 
     // sound
-    soundEngine->soundSystem()->playSound(
-        FMOD_CHANNEL_REUSE, soundEngine->sound("explosion"), false, d->channel);
-    d->channel->set3DAttributes(d->origin);
+    soundEngine->playEffect("explosion", d->origin);
 }
 
 Cluster::~Cluster ()
@@ -125,12 +99,19 @@ QScriptValue emitFun (QScriptContext* ctx, QScriptEngine* engine)
     return QScriptValue();
 }
 
+/**
+ * Let the shell script emit the stars.
+ *
+ * Unlike the star texture this stays off the JobSystem: the script runs on
+ * the scene's engine, which belongs to the GUI thread, and all it leaves
+ * for each star is an append.
+ */
 void Cluster::setup ()
 {
     QScriptEngine* engine = scene->scriptEngine();
     QScriptContext* ctx = engine->pushContext();
     QScriptValue ao = ctx->activationObject();
-    prepGlobalObject(ao);
+    prepGlobalObject(engine, ao, soundEngine->features());
     ao.setProperty("emit", engine->newFunction(emitFun));
 
     /// @todo is this the best way to get access to the cluster?
@@ -147,26 +128,33 @@ void Cluster::emitStar (btVector3 initialVelocity)
     d->starCount++;
 }
 
-void Cluster::update (qreal dt)
+/**
+ * How long the cluster burns, in seconds.
+ *
+ * Aged by the Simulation, which says when it is over.
+ */
+qreal Cluster::lifetime () const
 {
-    if (d->age >= d->lifetime) {
-        deleteLater();
-    } else {
-        d->age += dt;
-    }
+    return d->lifetime;
 }
 
-void Cluster::draw ()
+/**
+ * @param[in] age since the burst, in seconds
+ * @param[in] shader of the bound fyreworks program
+ *
+ * @warning render thread only
+ */
+void Cluster::draw (qreal age, const ClusterShader& shader)
 {
     glColor3fv(d->color);
 
-    cgGLEnableClientState(d->shader.v0);
-    cgGLSetParameter1f(d->shader.t, d->age);
-    cgGLSetParameter1f(d->shader.nt, d->age/d->lifetime);
-    cgGLSetParameterPointer(d->shader.v0, 3, GL_FLOAT, sizeof(btVector3),
+    cgGLEnableClientState(shader.v0);
+    cgGLSetParameter1f(shader.t, age);
+    cgGLSetParameter1f(shader.nt, age/d->lifetime);
+    cgGLSetParameterPointer(shader.v0, 3, GL_FLOAT, sizeof(btVector3),
                             d->initialVelocities[0]);
-    cgGLSetParameter3fv(d->shader.origin, d->origin);
-    cgGLSetParameter3fv(d->shader.eye, scene->camera()->position());
+    cgGLSetParameter3fv(shader.origin, d->origin);
+    cgGLSetParameter3fv(shader.eye, scene->eye());
     glDrawArrays(GL_POINTS, 0, d->starCount);
-    cgGLDisableClientState(d->shader.v0);
+    cgGLDisableClientState(shader.v0);
 }
@@ -11,8 +11,24 @@
 
 #include <LinearMath/btVector3.h>
 
+#include <Cg/cg.h>
+
 class QScriptProgram;
 
+/**
+ * Parameters of the fyreworks shader clusters are drawn with.
+ *
+ * Looked up once by the Scene, on the thread that owns the Cg context.
+ */
+struct ClusterShader
+{
+    CGparameter v0;
+    CGparameter t;
+    CGparameter nt;
+    CGparameter origin;
+    CGparameter eye;
+};
+
 class Cluster : public QObject
 {
     Q_OBJECT
@@ -26,9 +42,9 @@ public:
 
     Q_INVOKABLE void emitStar (btVector3 initialVelocity);
 
-public slots:
-    void draw ();
-    void update (qreal dt);
+    qreal lifetime () const;
+
+    void draw (qreal age, const ClusterShader& shader);
 
 private:
     void setup ();
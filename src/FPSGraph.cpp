@@ -110,7 +110,10 @@ void FPSGraph::addSample (qreal realDt, qreal smoothedDt)
     expMovAvg(d->maxSample, maxSample, d->sampleCount * 0.66);
 }
 
-void FPSGraph::draw ()
+/**
+ * @param[in] viewport as last set, the GL state is not read back
+ */
+void FPSGraph::draw (const QSize& viewport)
 {
     glDepthMask(GL_FALSE);
     glPushAttrib(GL_ENABLE_BIT);
@@ -119,17 +122,14 @@ void FPSGraph::draw ()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    int viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    glOrtho(viewport[0], viewport[2], viewport[1], viewport[3], -1, 1);
+    glOrtho(0, viewport.width(), 0, viewport.height(), -1, 1);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    glTranslated(viewport[2] - d->size.width(),
-                 viewport[3] - d->size.height(),
+    glTranslated(viewport.width() - d->size.width(),
+                 viewport.height() - d->size.height(),
                  0.0);
 
     glScaled(d->size.width() / d->fpsMax,
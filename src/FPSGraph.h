@@ -23,6 +23,7 @@
 
 #include <QObject>
 #include <QSizeF>
+#include <QSize>
 
 class FPSGraph : public QObject
 {
@@ -38,7 +39,7 @@ public:
     void addSample (qreal realDt, qreal smoothedDt);
 
 public slots:
-    void draw ();
+    void draw (const QSize& viewport);
 
 private:
     struct Private;
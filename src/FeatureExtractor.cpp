@@ -0,0 +1,234 @@
+
+/**
+ * @file FeatureExtractor.cpp
+ * @brief FeatureExtractor implementation
+ */
+
+#include "FeatureExtractor.h"
+
+#include "defs.h"
+#include "Analysis.h"
+#include "AnalysisCache.h"
+
+#include <QDateTime>
+#include <QSettings>
+#include <QThread>
+#include <QDebug>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+
+#include <math.h>
+
+/**
+ * How long to back off per decoded block while a song is playing.
+ *
+ * In milliseconds.
+ */
+#define THROTTLE_SLEEP 5
+
+/**
+ * Loudness that maps to a replay gain of 0 dB.
+ */
+#define REFERENCE_LOUDNESS -20.0
+
+/**
+ * @class FeatureExtractor
+ *
+ * @brief decodes a whole track ahead of time to describe it
+ *
+ * Runs on the scanner pool, one QtFMOD::System per job, and stores tempo,
+ * loudness, replay gain and onset density in the streams table.  The decoded
+ * analysis is kept as an AnalysisCache, so the track never has to be
+ * analyzed again when it is played.
+ *
+ * Only the database's settings are kept, not the database, so a job may
+ * outlive the connection it was queued from.  abort() at exit makes running
+ * jobs stop at the next block and queued ones return at once.
+ */
+
+static QAtomicInt extractorThrottled (0);
+static QAtomicInt extractorAborted (0);
+
+/**
+ * QThread::msleep() is protected.
+ */
+class Sleeper : public QThread
+{
+public:
+    using QThread::msleep;
+};
+
+struct FeatureExtractor::Private
+{
+    QUrl url;
+
+    // of the database to clone
+    QString driverName;
+    QString databaseName;
+    QString connectOptions;
+    QString hostName;
+    int port;
+    QString userName;
+    QString password;
+
+    Private (const QUrl& url, const QSqlDatabase& dbToClone) :
+        url(url),
+        driverName(dbToClone.driverName()),
+        databaseName(dbToClone.databaseName()),
+        connectOptions(dbToClone.connectOptions()),
+        hostName(dbToClone.hostName()),
+        port(dbToClone.port()),
+        userName(dbToClone.userName()),
+        password(dbToClone.password())
+    {
+    }
+
+    bool analyze ();
+    bool store (const AnalysisCache& cache);
+};
+
+FeatureExtractor::FeatureExtractor (const QUrl& url,
+                                    const QSqlDatabase& dbToClone) :
+    QRunnable(),
+    d(new Private(url, dbToClone))
+{
+}
+
+FeatureExtractor::~FeatureExtractor ()
+{
+}
+
+bool FeatureExtractor::isEnabled ()
+{
+    return QSettings().value("analysis/extractFeatures", false).toBool();
+}
+
+/**
+ * Slow down all extractors, e.g. while audio is playing.
+ */
+void FeatureExtractor::setThrottled (bool throttled)
+{
+    extractorThrottled = throttled ? 1 : 0;
+}
+
+/**
+ * Stop all extractors, running and queued, e.g. before quitting.
+ *
+ * @warning for good, there is no way to resume
+ */
+void FeatureExtractor::abort ()
+{
+    extractorAborted = 1;
+}
+
+bool FeatureExtractor::isAborted ()
+{
+    return extractorAborted;
+}
+
+/**
+ * @warning Designed to run in separate thread.
+ */
+void FeatureExtractor::run ()
+{
+    if (extractorAborted) {
+        return;
+    }
+
+    if (!AnalysisCache(d->url).isValid() && !d->analyze()) {
+        return;
+    }
+
+    AnalysisCache cache (d->url);
+    if (!cache.isValid()) {
+        return;
+    }
+
+    d->store(cache);
+}
+
+/**
+ * Decode the track as fast as allowed, writing its AnalysisCache.
+ */
+bool FeatureExtractor::Private::analyze ()
+{
+    HopDecoder decoder (url.toString());
+    if (!decoder.isOpen()) {
+        return false;
+    }
+
+    AnalysisCacheWriter writer (url);
+    if (!writer.isOpen()) {
+        return false;
+    }
+
+    while (decoder.next()) {
+        writer.append(decoder.frame());
+
+        if (extractorAborted) {
+            return false;
+        }
+        if (extractorThrottled) {
+            Sleeper::msleep(THROTTLE_SLEEP);
+        }
+    }
+
+    return writer.commit();
+}
+
+/**
+ * Store the features summarized by @a cache in the streams table.
+ */
+bool FeatureExtractor::Private::store (const AnalysisCache& cache)
+{
+    qreal bpm = cache.beatPeriod() > 0.0 ? 60000.0 / cache.beatPeriod() : 0.0;
+    qreal loudness = 10.0 * log10(qMax(cache.loudness(), 1e-6f));
+    qreal seconds = cache.duration() * 0.001;
+    qreal onsetDensity = seconds > 0.0 ? cache.onsetCount() / seconds : 0.0;
+
+    QString connectionName ("FeatureExtractor%0");
+    connectionName = connectionName.arg((quint64)this);
+    bool ok;
+    {
+        QSqlDatabase db (
+            QSqlDatabase::addDatabase(driverName, connectionName));
+        db.setDatabaseName(databaseName);
+        db.setConnectOptions(connectOptions);
+        db.setHostName(hostName);
+        db.setPort(port);
+        db.setUserName(userName);
+        db.setPassword(password);
+        if (!db.open()) {
+            qCritical() << db.lastError();
+            return false;
+        }
+
+        QSqlQuery q (db);
+        q.prepare(
+            "update streams set "
+            "bpm = :bpm, "
+            "loudness = :loudness, "
+            "replayGain = :replayGain, "
+            "onsetDensity = :onsetDensity, "
+            "analyzedAt = :analyzedAt "
+            "where url = :url "
+            );
+        q.bindValue(":url"         , url.toString());
+        q.bindValue(":bpm"         , bpm);
+        q.bindValue(":loudness"    , loudness);
+        q.bindValue(":replayGain"  , REFERENCE_LOUDNESS - loudness);
+        q.bindValue(":onsetDensity", onsetDensity);
+        q.bindValue(":analyzedAt"  , QDateTime::currentDateTime());
+
+        ok = q.exec();
+        if (!ok) {
+            qWarning() << Q_FUNC_INFO << __LINE__ << q.lastQuery();
+            qWarning() << Q_FUNC_INFO << __LINE__ << q.lastError();
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
@@ -0,0 +1,31 @@
+
+/**
+ * @file FeatureExtractor.h
+ * @brief FeatureExtractor definition
+ */
+
+#pragma once
+
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QUrl>
+
+class QSqlDatabase;
+
+class FeatureExtractor : public QRunnable
+{
+public:
+    FeatureExtractor (const QUrl& url, const QSqlDatabase& dbToClone);
+    virtual ~FeatureExtractor ();
+
+    virtual void run ();
+
+    static bool isEnabled ();
+    static void setThrottled (bool throttled);
+    static void abort ();
+    static bool isAborted ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,333 @@
+/**
+ * @file FeatureGraph.cpp
+ * @brief FeatureGraph implementation
+ */
+
+#include "FeatureGraph.moc"
+
+#include "defs.h"
+#include "Analysis.h"
+
+#include <QScriptEngine>
+#include <QDebug>
+
+/**
+ * Default number of hops a feature stays active after it was last used.
+ */
+#define ACTIVE_HOPS 64
+
+/**
+ * @class FeatureGraph
+ *
+ * @brief lazily evaluated analysis features, one hop at a time
+ *
+ * Features are only computed when they are asked for, and at most once per
+ * hop.  Asking for a feature also counts as using everything it is derived
+ * from.  Features used within the last activeHops hops are computed up
+ * front on every beginHop(), so stateful ones like Onset keep their
+ * history; the others cost nothing until a script looks at them again.
+ *
+ * expose() installs the features as getters on a script object, so only
+ * what a script actually reads gets computed or converted.  All scripts
+ * share the converted values of a hop, so their elements are read-only.
+ *
+ * There is no chroma: at SPECTRUM_LENGTH bins a semitone only spans a bin
+ * from about 1.6 kHz up, which leaves out the fundamentals it is about.
+ */
+
+namespace
+{
+
+/**
+ * What a feature looks like to scripts.
+ */
+enum Shape
+{
+    Scalar,
+    Flag,
+    Stereo
+};
+
+struct FeatureInfo
+{
+    const char* name;
+    Shape shape;
+};
+
+const FeatureInfo features[FeatureGraph::FeatureCount] = {
+    { "spectrum", Stereo },
+    { "bands"   , Stereo },
+    { "loudness", Scalar },
+    { "flux"    , Scalar },
+    { "onset"   , Flag   }
+};
+
+struct Node
+{
+    QVector<float> value;   ///< Stereo features hold channel 0, then 1
+    qint64 computedHop;
+    qint64 usedHop;
+    QScriptValue script;    ///< value, converted
+    qint64 scriptHop;
+
+    Node () :
+        computedHop(-1),
+        usedHop(-1000000),
+        scriptHop(-1)
+    {
+    }
+};
+
+/**
+ * Getter installed by expose(); the data holds the graph and the feature.
+ */
+QScriptValue featureGetter (QScriptContext* ctx, QScriptEngine* eng)
+{
+    QScriptValue data (ctx->callee().data());
+    FeatureGraph* graph = qobject_cast<FeatureGraph*>(
+        data.property("graph").toQObject());
+    if (!graph) {
+        return QScriptValue();
+    }
+    FeatureGraph::Feature feature = FeatureGraph::Feature(
+        data.property("feature").toInt32());
+    return graph->scriptValue(eng, feature);
+}
+
+} // namespace
+
+struct FeatureGraph::Private
+{
+    FeatureGraph* q;
+    Node nodes[FeatureCount];
+    qint64 hop;
+    int activeHops;
+    quint32 time;
+
+    QVector<float> prevSpectrum;
+    float fluxAvg;
+
+    Private (FeatureGraph* q) :
+        q(q),
+        hop(0),
+        activeHops(ACTIVE_HOPS),
+        time(0),
+        fluxAvg(0.0f)
+    {
+        prevSpectrum.fill(0.0f, 2 * SPECTRUM_LENGTH);
+        nodes[Spectrum].value.fill(0.0f, 2 * SPECTRUM_LENGTH);
+    }
+
+    void compute (Feature feature);
+};
+
+FeatureGraph::FeatureGraph (QObject* parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+}
+
+FeatureGraph::~FeatureGraph ()
+{
+}
+
+/**
+ * How many hops a feature keeps being computed after it was last used.
+ */
+void FeatureGraph::setActiveHops (int hops)
+{
+    d->activeHops = hops;
+}
+
+/**
+ * Move on to the next hop.
+ *
+ * Computes every active feature right away, the rest wait to be asked for.
+ *
+ * @param[in] spectrum both channels, smoothed
+ * @param[in] time track position of the hop, in milliseconds
+ */
+void FeatureGraph::beginHop (const QVector<float>* spectrum, quint32 time)
+{
+    Node& source (d->nodes[Spectrum]);
+    d->prevSpectrum = source.value;
+
+    d->hop++;
+    d->time = time;
+
+    float* out = source.value.data();
+    for (int c = 0; c < 2; c++) {
+        int n = qMin(spectrum[c].size(), SPECTRUM_LENGTH);
+        memcpy(out + c * SPECTRUM_LENGTH, spectrum[c].constData(),
+               n * sizeof(float));
+    }
+    source.computedHop = d->hop;
+
+    for (int f = Spectrum + 1; f < FeatureCount; f++) {
+        if (isActive(Feature(f))) {
+            d->compute(Feature(f));
+        }
+    }
+}
+
+/**
+ * Track position of the current hop, in milliseconds.
+ */
+quint32 FeatureGraph::time () const
+{
+    return d->time;
+}
+
+/**
+ * The value of @a feature for the current hop, computed if need be.
+ *
+ * Marks @a feature, and what it is derived from, as used.
+ */
+const QVector<float>& FeatureGraph::value (Feature feature)
+{
+    Node& node (d->nodes[feature]);
+    node.usedHop = d->hop;
+    if (node.computedHop != d->hop) {
+        d->compute(feature);
+    }
+    return node.value;
+}
+
+/**
+ * The value of a Scalar or Flag feature.
+ */
+float FeatureGraph::scalar (Feature feature)
+{
+    const QVector<float>& v (value(feature));
+    return v.isEmpty() ? 0.0f : v.first();
+}
+
+/**
+ * Whether @a feature was used within the last activeHops hops.
+ */
+bool FeatureGraph::isActive (Feature feature) const
+{
+    return d->hop - d->nodes[feature].usedHop <= d->activeHops;
+}
+
+QString FeatureGraph::name (Feature feature)
+{
+    return features[feature].name;
+}
+
+/**
+ * Install every feature on @a sv as a read-only getter.
+ */
+void FeatureGraph::expose (QScriptEngine* engine, QScriptValue& sv)
+{
+    QScriptValue graph (engine->newQObject(this));
+    for (int f = 0; f < FeatureCount; f++) {
+        QScriptValue data (engine->newObject());
+        data.setProperty("graph", graph);
+        data.setProperty("feature", f);
+
+        QScriptValue getter (engine->newFunction(featureGetter));
+        getter.setData(data);
+        sv.setProperty(features[f].name, getter, QScriptValue::PropertyGetter);
+    }
+}
+
+/**
+ * @a feature converted for scripts, once per hop.
+ *
+ * Scripts tend to read a feature inside a loop, so the conversion is kept.
+ * It is handed to every script that asks, so one script can not change
+ * what the others see: the elements are read-only and undeletable.
+ */
+QScriptValue FeatureGraph::scriptValue (QScriptEngine* engine,
+                                        Feature feature)
+{
+    const QVector<float>& v (value(feature));
+    Node& node (d->nodes[feature]);
+    if (node.scriptHop == d->hop && node.script.engine() == engine) {
+        return node.script;
+    }
+
+    const QScriptValue::PropertyFlags frozen
+        = QScriptValue::ReadOnly | QScriptValue::Undeletable;
+
+    switch (features[feature].shape) {
+    case Scalar:
+        node.script = QScriptValue(v.isEmpty() ? 0.0 : v.first());
+        break;
+    case Flag:
+        node.script = QScriptValue(!v.isEmpty() && v.first() != 0.0f);
+        break;
+    case Stereo: {
+        int n = v.size() / 2;
+        node.script = engine->newArray(2);
+        for (int c = 0; c < 2; c++) {
+            QScriptValue channel (engine->newArray(n));
+            const float* in = v.constData() + c * n;
+            for (int i = 0; i < n; i++) {
+                channel.setProperty(i, in[i], frozen);
+            }
+            node.script.setProperty(c, channel, frozen);
+        }
+        break;
+    }
+    }
+    node.scriptHop = d->hop;
+    return node.script;
+}
+
+/**
+ * Compute @a feature for the current hop.
+ *
+ * Inputs are fetched through value(), so they count as used too.
+ */
+void FeatureGraph::Private::compute (Feature feature)
+{
+    Node& node (nodes[feature]);
+
+    switch (feature) {
+    case Spectrum:
+        // the source, set by beginHop()
+        break;
+    case Bands: {
+        const QVector<float>& spectrum (q->value(Spectrum));
+        QVector<float> channel;
+        QVector<float> bands;
+        node.value.resize(2 * SPECTRUM_BANDS);
+        for (int c = 0; c < 2; c++) {
+            channel = spectrum.mid(c * SPECTRUM_LENGTH, SPECTRUM_LENGTH);
+            summarizeBands(channel, bands);
+            memcpy(node.value.data() + c * SPECTRUM_BANDS, bands.constData(),
+                   SPECTRUM_BANDS * sizeof(float));
+        }
+        break;
+    }
+    case Loudness: {
+        const QVector<float>& spectrum (q->value(Spectrum));
+        float loudness = 0.0f;
+        for (int i = 0; i < spectrum.size(); i++) {
+            loudness += spectrum[i];
+        }
+        node.value.fill(loudness, 1);
+        break;
+    }
+    case Flux: {
+        const QVector<float>& spectrum (q->value(Spectrum));
+        float flux = 0.0f;
+        for (int i = 0; i < spectrum.size(); i++) {
+            flux += qMax(0.0f, spectrum[i] - prevSpectrum[i]);
+        }
+        node.value.fill(flux, 1);
+        break;
+    }
+    case Onset: {
+        bool onset = pickOnset(q->scalar(Flux), fluxAvg);
+        node.value.fill(onset ? 1.0f : 0.0f, 1);
+        break;
+    }
+    case FeatureCount:
+        break;
+    }
+
+    node.computedHop = hop;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file FeatureGraph.h
+ * @brief FeatureGraph definition
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QVector>
+#include <QScopedPointer>
+
+class QScriptEngine;
+class QScriptValue;
+
+class FeatureGraph : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Every feature, in dependency order: a feature only depends on the
+     * ones before it.
+     */
+    enum Feature
+    {
+        Spectrum,       ///< smoothed spectrum, both channels
+        Bands,          ///< log-spaced band peaks, both channels
+        Loudness,       ///< summed spectrum of both channels
+        Flux,           ///< onset strength
+        Onset,          ///< 1 on an onset, 0 otherwise
+        FeatureCount
+    };
+
+    FeatureGraph (QObject* parent = NULL);
+    virtual ~FeatureGraph ();
+
+    void setActiveHops (int hops);
+
+    void beginHop (const QVector<float>* spectrum, quint32 time);
+    quint32 time () const;
+
+    const QVector<float>& value (Feature feature);
+    float scalar (Feature feature);
+    bool isActive (Feature feature) const;
+
+    static QString name (Feature feature);
+
+    void expose (QScriptEngine* engine, QScriptValue& sv);
+    QScriptValue scriptValue (QScriptEngine* engine, Feature feature);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,255 @@
+/**
+ * @file FramePacer.cpp
+ * @brief FramePacer implementation
+ */
+
+#include "FramePacer.h"
+
+#include "defs.h"
+
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QDebug>
+
+/**
+ * Display refresh rate assumed until presents say otherwise, in Hz.
+ */
+#define DEFAULT_REFRESH_RATE 60.0
+
+/**
+ * Time kept free before a deadline for whatever else runs, in nanoseconds.
+ */
+#define DEADLINE_MARGIN 1000000
+
+/**
+ * Presents the refresh interval estimate is averaged over.
+ */
+#define REFRESH_FRAMES 120
+
+/**
+ * @class FramePacer
+ *
+ * @brief predicts vertical blanks and times frames to meet them
+ *
+ * Every present is reported through presented().  The time between two
+ * presents, in refresh intervals, tells how many vertical blanks were
+ * missed.  When presentation is synced to the display, presents one
+ * interval apart also refine the refresh interval, which starts out at
+ * render/refreshRate.
+ *
+ * From the last present, the interval and the smoothed render time, the
+ * pacer predicts when the next present can happen and by when drawing has
+ * to start for it.  A frame driver schedule()s its next frame for that
+ * deadline.  Should it wake up too late to make the vertical blank it was
+ * aiming for, it drop()s the frame and schedules the next one, rather than
+ * drawing it anyway and pushing every frame after it back.
+ *
+ * All times are in nanoseconds on a monotonic clock.
+ *
+ * @warning Not thread safe; owned by the thread driving the frames.
+ */
+
+struct FramePacer::Private
+{
+    QElapsedTimer clock;
+    int swapInterval;
+
+    qint64 refreshNs;
+    qint64 renderNs;            ///< smoothed
+    qint64 lastPresent;         ///< -1 before the first
+    qint64 scheduled;           ///< deadline of the next frame, -1 if none
+
+    int frames;
+    int missed;
+    int dropped;
+
+    Private () :
+        swapInterval(0),
+        renderNs(0),
+        lastPresent(-1),
+        scheduled(-1),
+        frames(0),
+        missed(0),
+        dropped(0)
+    {
+        clock.start();
+
+        qreal rate = QSettings().value(
+            "render/refreshRate", DEFAULT_REFRESH_RATE).toReal();
+        if (rate <= 0.0) {
+            rate = DEFAULT_REFRESH_RATE;
+        }
+        refreshNs = qint64(1e9 / rate);
+    }
+};
+
+FramePacer::FramePacer () :
+    d(new Private)
+{
+}
+
+FramePacer::~FramePacer ()
+{
+}
+
+/**
+ * The swap interval of the context presenting the frames, 0 or less if
+ * presents are not synced to the display.
+ */
+void FramePacer::setSwapInterval (int interval)
+{
+    d->swapInterval = interval;
+}
+
+bool FramePacer::isSynced () const
+{
+    return d->swapInterval > 0;
+}
+
+qint64 FramePacer::now () const
+{
+    return d->clock.nsecsElapsed();
+}
+
+/**
+ * Estimated time between presents, at the swap interval.
+ */
+qint64 FramePacer::refreshInterval () const
+{
+    return d->refreshNs * qMax(1, d->swapInterval);
+}
+
+/**
+ * When the next frame could be presented at the earliest, if drawing
+ * started now.
+ */
+qint64 FramePacer::nextPresent () const
+{
+    qint64 t = now();
+    qint64 interval = refreshInterval();
+    if (d->lastPresent < 0) {
+        return t + interval;
+    }
+    qint64 ready = t + d->renderNs;
+    qint64 k = (ready - d->lastPresent) / interval + 1;
+    return d->lastPresent + k * interval;
+}
+
+/**
+ * Time left until drawing has to start to make nextPresent(), at least 0.
+ */
+qint64 FramePacer::untilDeadline () const
+{
+    qint64 deadline = nextPresent() - d->renderNs - DEADLINE_MARGIN;
+    return qMax(Q_INT64_C(0), deadline - now());
+}
+
+/**
+ * Aim the next frame at nextPresent().
+ *
+ * @return milliseconds until drawing should start, for a QTimer
+ */
+int FramePacer::schedule ()
+{
+    qint64 wait = untilDeadline();
+    d->scheduled = now() + wait;
+    return qMax(1, int((wait + 500000) / 1000000));
+}
+
+/**
+ * Whether the scheduled frame woke up too late for its vertical blank.
+ */
+bool FramePacer::isLate () const
+{
+    if (d->scheduled < 0) {
+        return false;
+    }
+    return now() > d->scheduled + refreshInterval() / 2;
+}
+
+/**
+ * The scheduled frame is skipped.
+ */
+void FramePacer::drop ()
+{
+    d->dropped++;
+}
+
+/**
+ * The next frame is not paced.
+ *
+ * It aims at no vertical blank, and the gap before it is no miss.
+ */
+void FramePacer::cancel ()
+{
+    d->scheduled = -1;
+    d->lastPresent = -1;
+}
+
+/**
+ * A frame was presented just now.
+ *
+ * @param[in] renderNs how long drawing it took
+ */
+void FramePacer::presented (qint64 renderNs)
+{
+    qint64 t = now();
+    d->frames++;
+
+    if (d->renderNs == 0) {
+        d->renderNs = renderNs;
+    } else {
+        expMovAvg(d->renderNs, renderNs, REFRESH_FRAMES);
+    }
+
+    if (d->lastPresent >= 0) {
+        qint64 interval = t - d->lastPresent;
+        qint64 expected = refreshInterval();
+        int vblanks = qMax(1, int((interval + expected / 2) / expected));
+        d->missed += vblanks - 1;
+
+        // only clean single intervals say anything about the display
+        if (isSynced() && vblanks == 1
+            && qAbs(interval - expected) < expected / 10) {
+            qint64 refresh = interval / d->swapInterval;
+            expMovAvg(d->refreshNs, refresh, REFRESH_FRAMES);
+        }
+    }
+    d->lastPresent = t;
+}
+
+int FramePacer::frames () const
+{
+    return d->frames;
+}
+
+/**
+ * Vertical blanks passed without a new frame since the first present.
+ */
+int FramePacer::missedVblanks () const
+{
+    return d->missed;
+}
+
+/**
+ * Frames skipped because they were late.
+ */
+int FramePacer::droppedFrames () const
+{
+    return d->dropped;
+}
+
+/**
+ * Log the counts, if any frame was presented.
+ */
+void FramePacer::report (const QString& name) const
+{
+    if (d->frames == 0) {
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << name << d->frames << "frames"
+             << d->missed << "missed vblanks"
+             << d->dropped << "dropped"
+             << 1e9 / d->refreshNs << "Hz"
+             << (isSynced() ? "synced" : "not synced");
+}
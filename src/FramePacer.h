@@ -0,0 +1,41 @@
+/**
+ * @file FramePacer.h
+ * @brief FramePacer definition
+ */
+
+#pragma once
+
+#include <QScopedPointer>
+#include <QString>
+#include <QtGlobal>
+
+class FramePacer
+{
+public:
+    FramePacer ();
+    ~FramePacer ();
+
+    void setSwapInterval (int interval);
+    bool isSynced () const;
+
+    qint64 now () const;
+    qint64 refreshInterval () const;
+    qint64 nextPresent () const;
+    qint64 untilDeadline () const;
+
+    int schedule ();
+    bool isLate () const;
+    void drop ();
+    void cancel ();
+
+    void presented (qint64 renderNs);
+
+    int frames () const;
+    int missedVblanks () const;
+    int droppedFrames () const;
+    void report (const QString& name) const;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,430 @@
+/**
+ * @file JobSystem.cpp
+ * @brief JobSystem implementation
+ */
+
+#include "JobSystem.moc"
+
+#include "ThreadManager.h"
+
+#include <QThread>
+#include <QThreadStorage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QVector>
+#include <QDebug>
+
+QPointer<JobSystem> jobSystem;
+
+/**
+ * @class Job
+ *
+ * @brief a piece of work for the JobSystem
+ *
+ * A job runs once all jobs it depends on have finished, and only after it
+ * was submitted.  Dependencies are added before submitting.
+ *
+ * Jobs are not deleted by default, so they can be waited for and live on the
+ * stack.  Fire and forget jobs set autoDelete, and must not be waited for.
+ */
+
+/**
+ * Guards the dependency edges of all jobs.
+ */
+static QMutex edgeMutex;
+
+/**
+ * @param[in] name timings are kept under
+ */
+Job::Job (const QString& name) :
+    jobName(name),
+    deleteWhenDone(false),
+    unfinished(1),
+    finished(0)
+{
+}
+
+Job::~Job ()
+{
+}
+
+QString Job::name () const
+{
+    return jobName;
+}
+
+bool Job::autoDelete () const
+{
+    return deleteWhenDone;
+}
+
+void Job::setAutoDelete (bool autoDelete)
+{
+    deleteWhenDone = autoDelete;
+}
+
+/**
+ * Run only after @a job has finished.
+ *
+ * @warning before this job is submitted
+ */
+void Job::addDependency (Job* job)
+{
+    QMutexLocker locker (&edgeMutex);
+    if (!job->finished) {
+        job->dependents << this;
+        unfinished.ref();
+    }
+}
+
+/**
+ * Run @a continuation once this job has finished.
+ *
+ * The continuation still has to be submitted.
+ */
+void Job::then (Job* continuation)
+{
+    continuation->addDependency(this);
+}
+
+bool Job::isFinished () const
+{
+    return finished;
+}
+
+/**
+ * @class JobSystem
+ *
+ * @brief runs jobs on a few worker threads
+ *
+ * Every worker has its own queue.  Jobs submitted or released by a worker go
+ * to the back of its queue and it takes from the back, so related work
+ * stays on one core while it is warm.  Idle workers steal from the front of
+ * the others' queues, and jobs from other threads go to a shared queue.
+ *
+ * A thread waiting for a job runs other jobs meanwhile, so waiting inside a
+ * job cannot starve the workers.
+ *
+ * The number of workers is one less than the number of cores, as the
+ * waiting thread helps, unless set by jobs/workers.
+ */
+
+namespace
+{
+
+struct WorkQueue
+{
+    QMutex mutex;
+    QList<Job*> jobs;
+};
+
+/**
+ * Which worker the current thread is.
+ */
+struct WorkerSlot
+{
+    JobSystem* system;
+    int index;
+};
+
+QThreadStorage<WorkerSlot*> currentWorker;
+
+} // namespace
+
+class JobWorker : public QThread
+{
+public:
+    JobWorker (JobSystem* system, int index) :
+        system(system),
+        index(index)
+    {
+    }
+
+protected:
+    void run ();
+
+private:
+    JobSystem* system;
+    int index;
+};
+
+struct JobSystem::Private
+{
+    QVector<WorkQueue*> queues;     ///< per worker, then the shared one
+    QList<JobWorker*> workers;
+
+    QMutex mutex;
+    QWaitCondition changed;         ///< work queued, or a job finished
+    QAtomicInt queued;
+    QAtomicInt waiters;
+    QAtomicInt stopping;
+
+    mutable QMutex timingMutex;
+    QHash<QString, JobTiming> timings;
+
+    Private () :
+        queued(0),
+        waiters(0),
+        stopping(0)
+    {
+    }
+
+    WorkQueue* shared () const
+    {
+        return queues.last();
+    }
+
+    int workerIndex (JobSystem* system) const
+    {
+        if (!currentWorker.hasLocalData()) {
+            return -1;
+        }
+        WorkerSlot* slot = currentWorker.localData();
+        return slot->system == system ? slot->index : -1;
+    }
+
+    void enqueue (JobSystem* system, Job* job);
+    Job* take (JobSystem* system);
+};
+
+JobSystem::JobSystem (QObject* parent) :
+    QObject(parent),
+    d(new Private)
+{
+    Q_ASSERT(!jobSystem);
+    jobSystem = this;
+
+    int count = QSettings().value(
+        "jobs/workers", QThread::idealThreadCount() - 1).toInt();
+    count = qMax(1, count);
+
+    for (int i = 0; i <= count; i++) {
+        d->queues << new WorkQueue;
+    }
+    for (int i = 0; i < count; i++) {
+        JobWorker* worker = new JobWorker(this, i);
+        d->workers << worker;
+        worker->start();
+    }
+}
+
+JobSystem::~JobSystem ()
+{
+    d->stopping = 1;
+    {
+        QMutexLocker locker (&d->mutex);
+        d->changed.wakeAll();
+    }
+    foreach (JobWorker* worker, d->workers) {
+        worker->wait();
+    }
+    qDeleteAll(d->workers);
+
+    foreach (WorkQueue* queue, d->queues) {
+        foreach (Job* job, queue->jobs) {
+            if (job->autoDelete()) {
+                delete job;
+            }
+        }
+    }
+    qDeleteAll(d->queues);
+}
+
+int JobSystem::workerCount () const
+{
+    return d->workers.size();
+}
+
+/**
+ * Run @a job once its dependencies have finished.
+ */
+void JobSystem::submit (Job* job)
+{
+    release(job);
+}
+
+/**
+ * Return once @a job has finished, running other jobs meanwhile.
+ */
+void JobSystem::wait (Job* job)
+{
+    while (!job->isFinished()) {
+        if (runOne()) {
+            continue;
+        }
+        QMutexLocker locker (&d->mutex);
+        d->waiters.ref();
+        if (!job->isFinished() && d->queued == 0) {
+            d->changed.wait(&d->mutex);
+        }
+        d->waiters.deref();
+    }
+}
+
+/**
+ * Time spent per job name, since startup.
+ */
+QHash<QString, JobTiming> JobSystem::timings () const
+{
+    QMutexLocker locker (&d->timingMutex);
+    return d->timings;
+}
+
+/**
+ * Log timings().
+ */
+void JobSystem::report () const
+{
+    QHash<QString, JobTiming> all (timings());
+    QHash<QString, JobTiming>::const_iterator it;
+    for (it = all.constBegin(); it != all.constEnd(); ++it) {
+        const JobTiming& t (it.value());
+        qDebug() << Q_FUNC_INFO << it.key() << t.count << "runs"
+                 << t.totalNs / 1000000.0 << "ms total"
+                 << t.maxNs / 1000000.0 << "ms max";
+    }
+}
+
+/**
+ * Run one queued job, if there is any.
+ */
+bool JobSystem::runOne ()
+{
+    Job* job = d->take(this);
+    if (!job) {
+        return false;
+    }
+    execute(job);
+    return true;
+}
+
+/**
+ * Run @a job, then release whatever waited for it.
+ */
+void JobSystem::execute (Job* job)
+{
+    QElapsedTimer t;
+    t.start();
+    job->run();
+    qint64 ns = t.nsecsElapsed();
+
+    {
+        QMutexLocker locker (&d->timingMutex);
+        JobTiming& timing (d->timings[job->name()]);
+        timing.count++;
+        timing.totalNs += ns;
+        timing.maxNs = qMax(timing.maxNs, ns);
+    }
+
+    // once finished is set, a waiter may delete the job
+    bool autoDelete = job->autoDelete();
+    QList<Job*> dependents;
+    {
+        QMutexLocker locker (&edgeMutex);
+        dependents = job->dependents;
+        job->dependents.clear();
+        job->finished.fetchAndStoreOrdered(1);
+    }
+    if (autoDelete) {
+        delete job;
+    }
+
+    foreach (Job* dependent, dependents) {
+        release(dependent);
+    }
+
+    if (d->waiters > 0) {
+        QMutexLocker locker (&d->mutex);
+        d->changed.wakeAll();
+    }
+}
+
+/**
+ * One less thing for @a job to wait for.
+ */
+void JobSystem::release (Job* job)
+{
+    if (!job->unfinished.deref()) {
+        d->enqueue(this, job);
+    }
+}
+
+void JobSystem::Private::enqueue (JobSystem* system, Job* job)
+{
+    int index = workerIndex(system);
+    WorkQueue* queue = index >= 0 ? queues[index] : shared();
+    queued.ref();
+    {
+        QMutexLocker locker (&queue->mutex);
+        queue->jobs.append(job);
+    }
+
+    QMutexLocker locker (&mutex);
+    changed.wakeOne();
+}
+
+/**
+ * The newest job of the current worker, else the oldest shared one, else
+ * one stolen from another worker.
+ */
+Job* JobSystem::Private::take (JobSystem* system)
+{
+    if (queued == 0) {
+        return NULL;
+    }
+
+    Job* job = NULL;
+    int index = workerIndex(system);
+    if (index >= 0) {
+        WorkQueue* own = queues[index];
+        QMutexLocker locker (&own->mutex);
+        if (!own->jobs.isEmpty()) {
+            job = own->jobs.takeLast();
+        }
+    }
+
+    // shared queue first, then the other workers, starting with the next
+    int workers = queues.size() - 1;
+    for (int i = 0; !job && i <= workers; i++) {
+        int victim = i == 0 ? workers : (index + i) % workers;
+        if (victim == index || victim < 0) {
+            continue;
+        }
+        WorkQueue* queue = queues[victim];
+        QMutexLocker locker (&queue->mutex);
+        if (!queue->jobs.isEmpty()) {
+            job = queue->jobs.takeFirst();
+        }
+    }
+
+    if (job) {
+        queued.deref();
+    }
+    return job;
+}
+
+void JobWorker::run ()
+{
+    if (threadManager) {
+        threadManager->enter(WorkerRole, QString("job%0").arg(index));
+    }
+
+    WorkerSlot* slot = new WorkerSlot;
+    slot->system = system;
+    slot->index = index;
+    currentWorker.setLocalData(slot);
+
+    JobSystem::Private* d = system->d.data();
+    while (!d->stopping) {
+        if (system->runOne()) {
+            continue;
+        }
+        QMutexLocker locker (&d->mutex);
+        if (!d->stopping && d->queued == 0) {
+            d->changed.wait(&d->mutex);
+        }
+    }
+}
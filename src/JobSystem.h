@@ -0,0 +1,178 @@
+/**
+ * @file JobSystem.h
+ * @brief JobSystem definition
+ */
+
+#pragma once
+
+#include "ThreadManager.h"
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QAtomicInt>
+
+class JobSystem;
+
+class Job
+{
+public:
+    Job (const QString& name);
+    virtual ~Job ();
+
+    QString name () const;
+
+    bool autoDelete () const;
+    void setAutoDelete (bool autoDelete);
+
+    void addDependency (Job* job);
+    void then (Job* continuation);
+
+    bool isFinished () const;
+
+protected:
+    virtual void run () = 0;
+
+private:
+    QString jobName;
+    bool deleteWhenDone;
+    QAtomicInt unfinished;      ///< dependencies, plus one until submitted
+    QAtomicInt finished;
+    QList<Job*> dependents;
+
+    friend class JobSystem;
+};
+
+/**
+ * Time spent in all jobs of one name.
+ */
+struct JobTiming
+{
+    int count;
+    qint64 totalNs;
+    qint64 maxNs;
+
+    JobTiming () :
+        count(0),
+        totalNs(0),
+        maxNs(0)
+    {
+    }
+};
+
+class JobSystem : public QObject
+{
+    Q_OBJECT
+
+public:
+    JobSystem (QObject* parent = NULL);
+    virtual ~JobSystem ();
+
+    int workerCount () const;
+
+    void submit (Job* job);
+    void wait (Job* job);
+
+    QHash<QString, JobTiming> timings () const;
+    void report () const;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+
+    bool runOne ();
+    void execute (Job* job);
+    void release (Job* job);
+
+    friend class JobWorker;
+};
+
+extern QPointer<JobSystem> jobSystem;
+
+/**
+ * Does nothing, only waits for its dependencies.
+ */
+class JoinJob : public Job
+{
+public:
+    JoinJob (const QString& name) :
+        Job(name)
+    {
+    }
+
+protected:
+    void run ()
+    {
+    }
+};
+
+/**
+ * One chunk of a parallelFor().
+ */
+template <typename Body>
+class RangeJob : public Job
+{
+public:
+    RangeJob (const QString& name, Body& body, int begin, int end) :
+        Job(name),
+        body(body),
+        begin(begin),
+        end(end)
+    {
+    }
+
+protected:
+    void run ()
+    {
+        body(begin, end);
+    }
+
+private:
+    Body& body;
+    int begin;
+    int end;
+};
+
+/**
+ * Call @a body with consecutive chunks of [@a begin, @a end) in parallel,
+ * and wait for all of them.
+ *
+ * @a body is called as body(chunkBegin, chunkEnd), from several threads at
+ * once, so it may only write what belongs to its chunk.  Runs inline when
+ * there is no JobSystem or the range is at most @a grain long, and for
+ * scanner threads, whose idle work must not take the workers' priority.
+ *
+ * @param[in] name timings are kept under
+ * @param[in] grain smallest chunk worth a job
+ */
+template <typename Body>
+void parallelFor (const QString& name, int begin, int end, int grain,
+                  Body& body)
+{
+    JobSystem* system = jobSystem;
+    int n = end - begin;
+    if (!system || n <= grain
+        || ThreadManager::currentRole() == ScannerRole) {
+        body(begin, end);
+        return;
+    }
+
+    // a few chunks per thread, so thieves have something to take
+    int chunk = qMax(grain, n / (4 * (system->workerCount() + 1)) + 1);
+
+    JoinJob join (name);
+    QList<Job*> chunks;
+    for (int i = begin; i < end; i += chunk) {
+        Job* job = new RangeJob<Body>(name, body, i, qMin(i + chunk, end));
+        join.addDependency(job);
+        chunks << job;
+    }
+    foreach (Job* job, chunks) {
+        system->submit(job);
+    }
+    system->submit(&join);
+    system->wait(&join);
+    qDeleteAll(chunks);
+}
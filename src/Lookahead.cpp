@@ -0,0 +1,191 @@
+
+/**
+ * @file Lookahead.cpp
+ * @brief Lookahead implementation
+ */
+
+#include "Lookahead.moc"
+
+#include "defs.h"
+#include "Analysis.h"
+#include "AnalysisCache.h"
+#include "ThreadManager.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDebug>
+
+/**
+ * How far ahead of playback to decode.
+ *
+ * In milliseconds.
+ */
+#define LOOKAHEAD_WINDOW 5000
+
+/**
+ * How much already played audio to keep around.
+ *
+ * In milliseconds.
+ */
+#define LOOKAHEAD_HISTORY 1000
+
+/**
+ * How far playback may drift outside of the decoded range before the
+ * decoder seeks instead of catching up.
+ *
+ * In milliseconds.
+ */
+#define LOOKAHEAD_SEEK_SLACK 500
+
+/**
+ * @class Lookahead
+ *
+ * @brief decodes the current track ahead of playback
+ *
+ * A second, non-realtime decoder for the playing track.  It stays up to
+ * LOOKAHEAD_WINDOW ahead of the playback position and keeps the smoothed
+ * spectrum of every hop, so the analyzer can react to audio before it is
+ * heard.
+ *
+ * If the whole track gets decoded front to back, the result is saved as an
+ * AnalysisCache for the next time it is played.  After a seek nothing is
+ * saved: a cache is taken as the whole track, and one with a hole would
+ * keep the track from ever being analyzed in full.  The FeatureExtractor
+ * writes complete caches in the background instead.
+ */
+
+struct Lookahead::Private
+{
+    QUrl url;
+
+    QAtomicInt playbackPosition;
+    QAtomicInt stopped;
+
+    mutable QMutex mutex;
+    QList<AnalysisFrame> frames;    ///< sorted by time
+
+    Private (const QUrl& url) :
+        url(url),
+        playbackPosition(0),
+        stopped(0)
+    {
+    }
+
+    void trim (quint32 playback);
+};
+
+Lookahead::Lookahead (const QUrl& url, QObject* parent) :
+    QThread(parent),
+    d(new Private(url))
+{
+}
+
+Lookahead::~Lookahead ()
+{
+    stop();
+    wait();
+}
+
+void Lookahead::setPlaybackPosition (quint32 ms)
+{
+    d->playbackPosition = ms;
+}
+
+void Lookahead::stop ()
+{
+    d->stopped = 1;
+}
+
+quint32 Lookahead::horizon () const
+{
+    QMutexLocker locker (&d->mutex);
+    return d->frames.isEmpty() ? 0 : d->frames.last().time;
+}
+
+QList<AnalysisFrame> Lookahead::frames (quint32 after, quint32 until) const
+{
+    QMutexLocker locker (&d->mutex);
+
+    QList<AnalysisFrame> frames;
+    foreach (const AnalysisFrame& frame, d->frames) {
+        if (frame.time > until) {
+            break;
+        }
+        if (frame.time > after) {
+            frames << frame;
+        }
+    }
+    return frames;
+}
+
+/**
+ * Drop frames that have already been played.
+ *
+ * @warning mutex must be held
+ */
+void Lookahead::Private::trim (quint32 playback)
+{
+    while (!frames.isEmpty()
+           && frames.first().time + LOOKAHEAD_HISTORY < playback) {
+        frames.removeFirst();
+    }
+}
+
+/**
+ * @warning Runs in its own thread.
+ */
+void Lookahead::run ()
+{
+    if (threadManager) {
+        threadManager->enter(WorkerRole, "lookahead");
+    }
+
+    HopDecoder decoder (d->url.toString());
+    if (!decoder.isOpen()) {
+        return;
+    }
+
+    AnalysisCacheWriter writer (d->url);
+    bool complete = true;   ///< decoded front to back without seeking
+
+    while (!d->stopped) {
+        quint32 playback = d->playbackPosition;
+        quint32 decoded = decoder.position();
+
+        {
+            QMutexLocker locker (&d->mutex);
+
+            // playback was moved outside of what we have, so start over there
+            quint32 first = d->frames.isEmpty()
+                ? decoded : d->frames.first().time;
+            if (playback + LOOKAHEAD_SEEK_SLACK < first
+                || playback > decoded + LOOKAHEAD_SEEK_SLACK) {
+                d->frames.clear();
+                complete = false;
+                decoder.seek(playback);
+                continue;
+            }
+
+            d->trim(playback);
+        }
+
+        if (decoded > playback + LOOKAHEAD_WINDOW) {
+            msleep(10);
+            continue;
+        }
+
+        if (!decoder.next()) {
+            if (complete) {
+                writer.commit();
+            }
+            break;
+        }
+
+        if (complete) {
+            writer.append(decoder.frame());
+        }
+
+        QMutexLocker locker (&d->mutex);
+        d->frames << decoder.frame();
+    }
+}
@@ -0,0 +1,35 @@
+
+/**
+ * @file Lookahead.h
+ * @brief Lookahead definition
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QUrl>
+
+#include "Analysis.h"
+
+class Lookahead : public QThread, public AnalysisSource
+{
+    Q_OBJECT
+
+public:
+    Lookahead (const QUrl& url, QObject* parent = NULL);
+    virtual ~Lookahead ();
+
+    void setPlaybackPosition (quint32 ms);
+
+    quint32 horizon () const;
+    QList<AnalysisFrame> frames (quint32 after, quint32 until) const;
+
+    void stop ();
+
+protected:
+    void run ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,162 @@
+/**
+ * @file MappedFile.cpp
+ * @brief memory mapped FMOD file access
+ *
+ * FMOD's own file I/O does many small reads.  These callbacks map the
+ * whole file instead and copy out of the page cache, so playback and tag
+ * scans cost no syscalls past the open, and the kernel reads ahead as
+ * told by madvise().
+ *
+ * Files that can not be mapped, like compressed Qt resources, are read
+ * through QFile.
+ */
+
+#include "MappedFile.h"
+
+#include <QtFMOD/System.h>
+
+#include <QFile>
+#include <QUrl>
+#include <QDebug>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+/**
+ * Block alignment asked of FMOD's reads, in bytes.
+ *
+ * A page: reads never straddle more pages than they have to.
+ */
+#define MAPPED_BLOCK_ALIGN 4096
+
+namespace
+{
+
+struct MappedFile
+{
+    QFile file;
+    const uchar* data;      ///< NULL if not mapped
+    quint64 size;
+    quint64 pos;
+
+    MappedFile (const QString& name) :
+        file(name),
+        data(NULL),
+        size(0),
+        pos(0)
+    {
+    }
+};
+
+FMOD_RESULT mappedOpen (const char* name, int unicode, unsigned int* filesize,
+                        void** handle, void** userdata, FileAccess access)
+{
+    Q_UNUSED(userdata);
+
+    QString path;
+    if (unicode) {
+        path = QString::fromWCharArray(reinterpret_cast<const wchar_t*>(name));
+    } else {
+        path = QFile::decodeName(name);
+    }
+    if (path.startsWith("file:")) {
+        path = QUrl(path).toLocalFile();
+    }
+
+    MappedFile* mf = new MappedFile(path);
+    if (!mf->file.open(QIODevice::ReadOnly)) {
+        delete mf;
+        return FMOD_ERR_FILE_NOTFOUND;
+    }
+    mf->size = mf->file.size();
+    mf->data = mf->file.map(0, mf->size);
+
+#if defined(Q_OS_UNIX) && defined(MADV_SEQUENTIAL)
+    if (mf->data) {
+        madvise(const_cast<uchar*>(mf->data), mf->size,
+                access == SequentialAccess ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+#else
+    Q_UNUSED(access);
+#endif
+
+    *filesize = mf->size;
+    *handle = mf;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK sequentialOpen (const char* name, int unicode,
+                                       unsigned int* filesize, void** handle,
+                                       void** userdata)
+{
+    return mappedOpen(name, unicode, filesize, handle, userdata,
+                      SequentialAccess);
+}
+
+FMOD_RESULT F_CALLBACK randomOpen (const char* name, int unicode,
+                                   unsigned int* filesize, void** handle,
+                                   void** userdata)
+{
+    return mappedOpen(name, unicode, filesize, handle, userdata,
+                      RandomAccess);
+}
+
+FMOD_RESULT F_CALLBACK mappedClose (void* handle, void* userdata)
+{
+    Q_UNUSED(userdata);
+    delete static_cast<MappedFile*>(handle);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK mappedRead (void* handle, void* buffer,
+                                   unsigned int sizebytes,
+                                   unsigned int* bytesread, void* userdata)
+{
+    Q_UNUSED(userdata);
+    MappedFile* mf = static_cast<MappedFile*>(handle);
+
+    quint64 n = qMin(quint64(sizebytes), mf->size - qMin(mf->pos, mf->size));
+    if (mf->data) {
+        memcpy(buffer, mf->data + mf->pos, n);
+    } else {
+        mf->file.seek(mf->pos);
+        n = qMax(mf->file.read(static_cast<char*>(buffer), n), qint64(0));
+    }
+    mf->pos += n;
+    *bytesread = n;
+
+    return n < sizebytes ? FMOD_ERR_FILE_EOF : FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK mappedSeek (void* handle, unsigned int pos,
+                                   void* userdata)
+{
+    Q_UNUSED(userdata);
+    MappedFile* mf = static_cast<MappedFile*>(handle);
+    if (pos > mf->size) {
+        return FMOD_ERR_FILE_COULDNOTSEEK;
+    }
+    mf->pos = pos;
+    return FMOD_OK;
+}
+
+} // namespace
+
+/**
+ * Have @a fsys read local files through memory maps.
+ *
+ * Has to be called before the system is initialized.  Network streams
+ * keep going through FMOD's own code.
+ */
+void useMappedFiles (QtFMOD::System* fsys, FileAccess access)
+{
+    fsys->setFileSystem(
+        access == SequentialAccess ? sequentialOpen : randomOpen,
+        mappedClose, mappedRead, mappedSeek, MAPPED_BLOCK_ALIGN);
+    if (fsys->error() != FMOD_OK) {
+        qWarning() << Q_FUNC_INFO << fsys->errorString();
+    }
+}
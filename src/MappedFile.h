@@ -0,0 +1,22 @@
+/**
+ * @file MappedFile.h
+ * @brief memory mapped FMOD file access
+ */
+
+#pragma once
+
+namespace QtFMOD
+{
+class System;
+}
+
+/**
+ * How a system's files are going to be read.
+ */
+enum FileAccess
+{
+    SequentialAccess,   ///< decoded front to back, read ahead aggressively
+    RandomAccess        ///< only headers are looked at, do not read ahead
+};
+
+void useMappedFiles (QtFMOD::System* fsys, FileAccess access);
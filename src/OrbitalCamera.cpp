@@ -99,7 +99,7 @@ void OrbitalCamera::setFocus (const btVector3& focus)
     d->focus = focus;
 }
 
-void OrbitalCamera::invoke ()
+void OrbitalCamera::update ()
 {
     setPosition(btVector3(
             d->focus.x() + d->distance * sin(d->altitude) * cos(d->azimuth),
@@ -108,7 +108,7 @@ void OrbitalCamera::invoke ()
             ));
     lookAt(d->focus);
 
-    Camera::invoke();
+    Camera::update();
 
 #if 0
     qDebug("distance=%f altitude=%f azimuth=%f",
@@ -32,7 +32,7 @@ public:
 
     void setFocus (const btVector3& focus);
 
-    virtual void invoke ();
+    virtual void update ();
 
 private:
     struct Private;
@@ -0,0 +1,259 @@
+/**
+ * @file PowerManager.cpp
+ * @brief PowerManager implementation
+ */
+
+#include "PowerManager.moc"
+
+#include "Telemetry.h"
+
+#include <QApplication>
+#include <QWidget>
+#include <QEvent>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QDebug>
+
+#include <time.h>
+
+/**
+ * Time without input before a paused player goes idle, in seconds.
+ *
+ * Overridden by the power/idleTimeout setting.
+ */
+#define IDLE_TIMEOUT 60
+
+/**
+ * How often the playback state is looked at, in milliseconds.
+ *
+ * Bounds how long starting playback takes to wake everything up.
+ */
+#define PLAYBACK_CHECK_INTERVAL 250
+
+QPointer<PowerManager> powerManager;
+
+/**
+ * @class PowerManager
+ *
+ * @brief throttles everything while nobody is watching or listening
+ *
+ * Hidden, when the watched window is hidden or minimized.  Otherwise
+ * active while playing or for a while after any input, and idle after
+ * that.  Whoever can save power connects to stateChanged().
+ *
+ * The CPU time of the whole process is accounted to the state it was
+ * spent in, see report().
+ */
+
+namespace
+{
+
+/**
+ * CPU time of the process, in milliseconds.
+ */
+qreal processCpuMs ()
+{
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+#endif
+    return 1000.0 * clock() / CLOCKS_PER_SEC;
+}
+
+} // namespace
+
+struct PowerManager::Private
+{
+    QPointer<QWidget> window;
+    QTimer* idleTimer;
+
+    PowerState state;
+    bool hidden;
+    bool playing;
+    bool recentInput;
+
+    QElapsedTimer since;        ///< the state was entered
+    qreal cpuSince;             ///< process cpu ms when it was entered
+    qreal wallMs[PowerStateCount];
+    qreal cpuMs[PowerStateCount];
+
+    Private (PowerManager* q) :
+        idleTimer(new QTimer(q)),
+        state(ActiveState),
+        hidden(false),
+        playing(false),
+        recentInput(true),
+        cpuSince(processCpuMs())
+    {
+        idleTimer->setObjectName("idleTimer");
+        idleTimer->setSingleShot(true);
+        idleTimer->setInterval(1000 * QSettings().value(
+                "power/idleTimeout", IDLE_TIMEOUT).toInt());
+
+        since.start();
+        for (int i = 0; i < PowerStateCount; i++) {
+            wallMs[i] = 0.0;
+            cpuMs[i] = 0.0;
+        }
+
+        QMetaObject::connectSlotsByName(q);
+    }
+
+    void account ();
+};
+
+PowerManager::PowerManager (QObject* parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+    Q_ASSERT(!powerManager);
+    powerManager = this;
+
+    qApp->installEventFilter(this);
+    d->idleTimer->start();
+
+    if (telemetry) {
+        telemetry->subscribe(this, "showTelemetry", PLAYBACK_CHECK_INTERVAL,
+                             QStringList()
+                             << "player/playing" << "player/paused");
+    }
+}
+
+PowerManager::~PowerManager ()
+{
+}
+
+/**
+ * Go hidden while @a window is hidden or minimized.
+ */
+void PowerManager::watch (QWidget* window)
+{
+    d->window = window;
+    update();
+}
+
+PowerState PowerManager::state () const
+{
+    return d->state;
+}
+
+QString PowerManager::stateName (PowerState state)
+{
+    switch (state) {
+    case ActiveState:
+        return "active";
+    case IdleState:
+        return "idle";
+    case HiddenState:
+        return "hidden";
+    case PowerStateCount:
+        break;
+    }
+    return QString();
+}
+
+/**
+ * Log the time and CPU spent in each state.
+ */
+void PowerManager::report () const
+{
+    d->account();
+    for (int i = 0; i < PowerStateCount; i++) {
+        if (d->wallMs[i] <= 0.0) {
+            continue;
+        }
+        qDebug() << Q_FUNC_INFO << stateName(PowerState(i))
+                 << d->wallMs[i] / 1000.0 << "s"
+                 << d->cpuMs[i] << "ms cpu"
+                 << 100.0 * d->cpuMs[i] / d->wallMs[i] << "% of a core";
+    }
+}
+
+/**
+ * Someone is there, stay active for a while.
+ */
+void PowerManager::wake ()
+{
+    d->idleTimer->start();
+    if (!d->recentInput) {
+        d->recentInput = true;
+        update();
+    }
+}
+
+bool PowerManager::eventFilter (QObject* obj, QEvent* evt)
+{
+    switch (evt->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseMove:
+    case QEvent::Wheel:
+    case QEvent::KeyPress:
+        wake();
+        break;
+    case QEvent::Show:
+    case QEvent::Hide:
+    case QEvent::WindowStateChange:
+        if (obj == d->window) {
+            update();
+        }
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(obj, evt);
+}
+
+void PowerManager::on_idleTimer_timeout ()
+{
+    d->recentInput = false;
+    update();
+}
+
+void PowerManager::showTelemetry (const QVariantHash& changes)
+{
+    Q_UNUSED(changes);
+
+    d->playing = telemetry->value("player/playing").toBool()
+        && !telemetry->value("player/paused").toBool();
+    update();
+}
+
+void PowerManager::update ()
+{
+    d->hidden = d->window
+        && (!d->window->isVisible() || d->window->isMinimized());
+
+    PowerState state;
+    if (d->hidden) {
+        state = HiddenState;
+    } else if (d->playing || d->recentInput) {
+        state = ActiveState;
+    } else {
+        state = IdleState;
+    }
+    if (state == d->state) {
+        return;
+    }
+
+    d->account();
+    d->state = state;
+    qDebug() << Q_FUNC_INFO << stateName(state);
+    if (telemetry) {
+        telemetry->post("power/state", stateName(state));
+    }
+    emit stateChanged(state);
+}
+
+/**
+ * Charge the time since the last call to the current state.
+ */
+void PowerManager::Private::account ()
+{
+    qreal cpu = processCpuMs();
+    wallMs[state] += since.restart();
+    cpuMs[state] += cpu - cpuSince;
+    cpuSince = cpu;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file PowerManager.h
+ * @brief PowerManager definition
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QVariant>
+
+class QWidget;
+
+/**
+ * Time between frames while idle, in milliseconds.
+ */
+#define IDLE_FRAME_INTERVAL 100
+
+/**
+ * How many regular simulation steps one step covers while not active.
+ *
+ * Bullet does that much less work, less accurately.
+ */
+#define IDLE_STEP_MULTIPLE 4
+
+enum PowerState
+{
+    ActiveState,                ///< playing, or in use
+    IdleState,                  ///< visible, but nothing going on
+    HiddenState,                ///< nothing to see
+    PowerStateCount
+};
+
+class PowerManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    PowerManager (QObject* parent = NULL);
+    virtual ~PowerManager ();
+
+    void watch (QWidget* window);
+
+    PowerState state () const;
+    static QString stateName (PowerState state);
+
+    void report () const;
+
+public slots:
+    void wake ();
+
+signals:
+    void stateChanged (PowerState state);
+
+protected:
+    bool eventFilter (QObject* obj, QEvent* evt);
+
+private slots:
+    void on_idleTimer_timeout ();
+    void showTelemetry (const QVariantHash& changes);
+
+private:
+    void update ();
+
+    struct Private;
+    QScopedPointer<Private> d;
+};
+
+extern QPointer<PowerManager> powerManager;
@@ -0,0 +1,167 @@
+/**
+ * @file RenderThread.cpp
+ * @brief RenderThread implementation
+ */
+
+#include "RenderThread.moc"
+
+#include "Scene.h"
+#include "FramePacer.h"
+#include "ThreadManager.h"
+
+#include <QGLWidget>
+#include <QPainter>
+#include <QPaintEngine>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QSize>
+#include <QDebug>
+
+/**
+ * @class RenderThread
+ *
+ * @brief draws the scene into a QGLWidget, apart from the GUI thread
+ *
+ * The thread owns the widget's context while it runs.  The GUI thread must
+ * release the context before start(), and keep away from it until the
+ * thread is stopped, which is why the widget passes resizes on instead of
+ * handling them.
+ *
+ * Frames are drawn back to back and paced by swapBuffers(), so with a swap
+ * interval of one they come at display rate, whatever the GUI thread is
+ * busy with.  Each swap is finished before the next frame starts, which
+ * keeps the driver from queueing frames and dates every present for the
+ * FramePacer.  Without a synced swap, the pacer's deadlines time the
+ * frames instead.  Either way, when the thread gets to a frame too late
+ * for the vertical blank it was aimed at, say after being descheduled, the
+ * frame is dropped and the next one aimed at the following blank.
+ *
+ * While idle, frames come every IDLE_FRAME_INTERVAL.  While hidden, the
+ * thread sleeps.
+ */
+
+struct RenderThread::Private
+{
+    Scene* scene;
+    QGLWidget* widget;
+    QAtomicInt stopped;
+    FramePacer pacer;
+
+    QMutex mutex;
+    QWaitCondition woken;       ///< stopped, or not hidden any more
+    QSize size;                 ///< of the widget, guarded by mutex
+    PowerState powerState;      ///< guarded by mutex
+
+    Private (Scene* scene, QGLWidget* widget) :
+        scene(scene),
+        widget(widget),
+        stopped(0),
+        powerState(ActiveState)
+    {
+    }
+};
+
+RenderThread::RenderThread (Scene* scene, QGLWidget* widget,
+                            QObject* parent) :
+    QThread(parent),
+    d(new Private(scene, widget))
+{
+    d->size = widget->size();
+}
+
+RenderThread::~RenderThread ()
+{
+    stop();
+    wait();
+}
+
+/**
+ * The widget was resized to @a size, the next frame is drawn to fit.
+ */
+void RenderThread::resize (const QSize& size)
+{
+    QMutexLocker locker (&d->mutex);
+    d->size = size;
+}
+
+void RenderThread::setPowerState (PowerState state)
+{
+    QMutexLocker locker (&d->mutex);
+    d->powerState = state;
+    d->woken.wakeAll();
+}
+
+void RenderThread::stop ()
+{
+    QMutexLocker locker (&d->mutex);
+    d->stopped = 1;
+    d->woken.wakeAll();
+}
+
+/**
+ * @warning Runs in its own thread.
+ */
+void RenderThread::run ()
+{
+    if (threadManager) {
+        threadManager->enter(RenderRole, "render");
+    }
+
+    d->widget->makeCurrent();
+    d->pacer.setSwapInterval(d->widget->format().swapInterval());
+
+    while (!d->stopped) {
+        QSize size;
+        PowerState state;
+        {
+            QMutexLocker locker (&d->mutex);
+            if (d->powerState == HiddenState) {
+                d->pacer.cancel();
+            }
+            while (d->powerState == HiddenState && !d->stopped) {
+                d->woken.wait(&d->mutex);
+            }
+            size = d->size;
+            state = d->powerState;
+        }
+        if (d->stopped) {
+            break;
+        }
+
+        if (state == IdleState) {
+            msleep(IDLE_FRAME_INTERVAL);
+            d->pacer.cancel();
+        } else if (!d->pacer.isSynced()) {
+            usleep(d->pacer.untilDeadline() / 1000);
+        }
+
+        if (d->pacer.isLate()) {
+            d->pacer.drop();
+            d->pacer.schedule();
+            continue;
+        }
+
+        qint64 start = d->pacer.now();
+
+        // sets the viewport, too
+        QPainter painter (d->widget);
+        if (painter.paintEngine()->type() != QPaintEngine::OpenGL2) {
+            qWarning() << Q_FUNC_INFO << "OpenGL 2 paint engine required";
+            break;
+        }
+        d->scene->render(&painter, size);
+        painter.end();
+        qint64 renderNs = d->pacer.now() - start;
+
+        d->widget->swapBuffers();
+        if (d->pacer.isSynced()) {
+            glFinish();
+        }
+        d->pacer.presented(renderNs);
+        d->pacer.schedule();
+    }
+
+    d->widget->doneCurrent();
+    d->pacer.report("render thread");
+}
@@ -0,0 +1,35 @@
+/**
+ * @file RenderThread.h
+ * @brief RenderThread definition
+ */
+
+#pragma once
+
+#include <QThread>
+
+#include "PowerManager.h"
+
+class QGLWidget;
+class QSize;
+
+class Scene;
+
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    RenderThread (Scene* scene, QGLWidget* widget, QObject* parent = NULL);
+    virtual ~RenderThread ();
+
+    void resize (const QSize& size);
+    void setPowerState (PowerState state);
+    void stop ();
+
+protected:
+    void run ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -28,9 +28,17 @@
 #include "ShaderProgram.h"
 #include "OrbitalCamera.h"
 #include "Shell.h"
+#include "Cluster.h"
+#include "Simulation.h"
 #include "FPSGraph.h"
+#include "FramePacer.h"
+#include "TripleBuffer.h"
 
 #include "scripting.h"
+#include "gldebug.h"
+#include "Telemetry.h"
+#include "Analysis.h"
+#include "JobSystem.h"
 
 #include <QGLWidget>
 #include <QTimer>
@@ -40,29 +48,47 @@
 #include <QDir>
 #include <QWheelEvent>
 #include <QGesture>
-#include <QtConcurrentMap>
 #include <QGLContext>
 #include <QUrl>
 #include <QScriptEngine>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QMutex>
+#include <QMutexLocker>
 
 #include <LinearMath/btVector3.h>
+#include <LinearMath/btTransform.h>
 
-#include <btBulletDynamicsCommon.h>
 
-#include <QtFMOD/System.h>
 
 #define SKY_TEX_MAX_WIDTH 1024
 
-#define SPECTRUM_HEIGHT 1
+/**
+ * Number of spectrum columns kept in the spectrogram ring.
+ */
+#define SPECTROGRAM_HISTORY 256
 
-#define glCheck()                                                           \
-    do {                                                                    \
-        GLuint gl_error = glGetError();                                     \
-        if (gl_error != GL_NO_ERROR) {                                      \
-            qFatal("OpenGL Error [%s:%d]: %s\n",                            \
-                   Q_FUNC_INFO, __LINE__, gluErrorString(gl_error));        \
-        }                                                                   \
-    } while (0)
+/**
+ * Fraction of the viewport height covered by the spectrogram.
+ */
+#define SPECTROGRAM_HEIGHT 0.2
+
+/**
+ * Frames the render latency is averaged over.
+ */
+#define RENDER_LATENCY_FRAMES 60
+
+/**
+ * How often the window title is brought up to date, in milliseconds.
+ */
+#define TITLE_UPDATE_INTERVAL 1000
+
+/**
+ * Time between ticks while nothing is drawn, in milliseconds.
+ *
+ * Keeps the sound listener and the renderer's input fresh.
+ */
+#define HIDDEN_TICK_INTERVAL 250
 
 #define sendStatusMessage(msg)                                              \
     do {                                                                    \
@@ -73,58 +99,122 @@
 
 QPointer<Scene> scene;
 
+/**
+ * What the renderer takes from the GUI thread, published once per tick.
+ *
+ * Drawing reads only this, the simulation snapshot and its own GL state, so
+ * it may run on another thread than the one feeding it.
+ */
+struct FrameInput
+{
+    btTransform view;           ///< of the smoothed camera
+    btVector3 eye;
+    QVector<float> spectrum[2];
+    QVector<float> bands[2];
+    QVector<float> spectrumHistory;
+    quint32 spectrumFrame;
+    bool isPlaying;
+    float outputLatency;        ///< in milliseconds
+    float syncOffset;           ///< in milliseconds
+
+    FrameInput () :
+        view(btTransform::getIdentity()),
+        eye(0.0, 0.0, 0.0),
+        spectrumFrame(0),
+        isPlaying(false),
+        outputLatency(0.0f),
+        syncOffset(0.0f)
+    {
+    }
+};
+
 struct Scene::Private
 {
     QTimer* timer;
 
     GLuint cubeMapTex;
     GLuint starTex;
+    GLuint spectrogramTex;
+    GLuint spectrumTex;
+    QVector<float> spectrumBands;
+    int spectrogramHead;            ///< next column to write
+    quint32 spectrogramFrame;       ///< last uploaded SoundEngine frame
+    CGparameter spectrogramOffset;
 
     OrbitalCamera* camera;
 
     ShaderProgram* skyShader;
     ShaderProgram* debugNormalsShader;
     ShaderProgram* fyreworksShader;
+    ClusterShader clusterShader;    ///< of fyreworksShader
+    ShaderProgram* spectrogramShader;
     QHash<QString, QPointer<ShaderProgram> > shaders;
 
-    QTime time;
+    QElapsedTimer time;         ///< since the last tick
     qreal dt;
+    FramePacer pacer;           ///< of frames drawn by drawBackground()
+    bool renderThreaded;        ///< a RenderThread draws, not the scene
+    PowerState powerState;
+
+    TripleBuffer<FrameInput> input;
+    QSize viewport;             ///< shadows GL_VIEWPORT, set by render()
 
     FPSGraph* fpsGraph;
+    QElapsedTimer frameClock;   ///< since the last frame was drawn
+    qreal frameDt;              ///< smoothed, between drawn frames
+    QElapsedTimer frameTimer;
+    qreal renderLatency;        ///< in milliseconds
+    QAtomicInt renderLatencyUs; ///< for the GUI thread
+    QAtomicInt renderFps;       ///< for the GUI thread
 
     QScriptEngine* scriptEngine;
     QHash<QString, QScriptProgram> shellPrograms;
     QScriptProgram analyzerProgram;
 
-    btDynamicsWorld* dynamicsWorld;
-    btBroadphaseInterface* broadphaseInterface;
-    btConstraintSolver* constraintSolver;
-    btCollisionConfiguration* collisionConfiguration;
-    btCollisionDispatcher* dispatcher;
+    Simulation* simulation;
+    qreal alpha;                ///< of the snapshot being drawn
+    QMutex clusterMutex;        ///< guards clusters while they are drawn
+    QHash<int, Cluster*> clusters;  ///< by id, while the simulation ages them
+    int nextClusterId;
 
     Private (Scene* q) :
         timer(new QTimer(q)),
         cubeMapTex(0),
         starTex(0),
+        spectrogramTex(0),
+        spectrumTex(0),
+        spectrogramHead(0),
+        spectrogramFrame(0),
+        spectrogramOffset(NULL),
         camera(new OrbitalCamera(q)),
         skyShader(new ShaderProgram(q)),
         debugNormalsShader(new ShaderProgram(q)),
         fyreworksShader(new ShaderProgram(q)),
+        spectrogramShader(new ShaderProgram(q)),
         dt(0.016),
+        renderThreaded(false),
+        powerState(ActiveState),
         fpsGraph(new FPSGraph(QSizeF(120 * 1.5, 60), 120, 60, q)),
+        frameDt(0.016),
+        renderLatency(0.0),
+        renderLatencyUs(0),
+        renderFps(0),
         scriptEngine(new QScriptEngine(q)),
 
-        dynamicsWorld(NULL),
-        broadphaseInterface(NULL),
-        constraintSolver(NULL),
-        collisionConfiguration(NULL),
-        dispatcher(NULL)
+        simulation(new Simulation(q)),
+        alpha(0.0),
+        nextClusterId(0)
     {
         timer->setObjectName("timer");
+        simulation->setObjectName("simulation");
+
+        camera->setMaxDistance(1000.0);
+        camera->setFocus(btVector3(0, 50, 0));
 
         shaders.insert("sky", skyShader);
         shaders.insert("debugNormals", debugNormalsShader);
         shaders.insert("fyreworks", fyreworksShader);
+        shaders.insert("spectrogram", spectrogramShader);
 
         QMetaObject::connectSlotsByName(q);
     }
@@ -140,6 +230,7 @@ Scene::Scene (QObject* parent) :
 
 Scene::~Scene ()
 {
+    d->pacer.report("scene");
 }
 
 void Scene::start ()
@@ -157,9 +248,16 @@ void Scene::start ()
     //grabGesture(Qt::PinchGesture);
     //grabGesture(Qt::SwipeGesture);
 
+    if (telemetry) {
+        telemetry->subscribe(this, "showTitle", TITLE_UPDATE_INTERVAL,
+                             QStringList() << "render/fps"
+                             << "player/title" << "player/artist");
+    }
+
     // start simulation
     d->time.start();
-    d->timer->start(16);
+    d->timer->setSingleShot(true);
+    d->timer->start(d->pacer.schedule());
 }
 
 ShaderProgram* Scene::shader (const QString& name) const
@@ -167,21 +265,79 @@ ShaderProgram* Scene::shader (const QString& name) const
     return d->shaders[name];
 }
 
-btDynamicsWorld* Scene::dynamicsWorld () const
+Camera* Scene::camera () const
 {
-    return d->dynamicsWorld;
+    return d->camera;
 }
 
-Camera* Scene::camera () const
+/**
+ * Ring of recent spectra, SPECTROGRAM_HISTORY columns wide.
+ *
+ * Luminance holds channel 0, alpha channel 1.
+ */
+uint Scene::spectrogramTexture () const
 {
-    return d->camera;
+    return d->spectrogramTex;
 }
 
+/**
+ * The current band summary, SPECTRUM_BANDS texels of a 1D texture.
+ *
+ * Luminance holds channel 0, alpha channel 1.  Bound to texture unit 1
+ * while the sky and the clusters are drawn.
+ */
+uint Scene::spectrumTexture () const
+{
+    return d->spectrumTex;
+}
+
+/**
+ * Draw at display rate while active, slower while idle, and not at all
+ * while hidden.  Outside of active the simulation steps in batches.
+ */
+void Scene::setPowerState (PowerState state)
+{
+    d->powerState = state;
+    d->simulation->setStepMultiple(
+        state == ActiveState ? 1 : IDLE_STEP_MULTIPLE);
+}
+
+/**
+ * Where the frame being drawn is seen from.
+ *
+ * @warning render thread only
+ */
+btVector3 Scene::eye () const
+{
+    return d->input.front().eye;
+}
+
+/**
+ * Smoothed real time between ticks of the GUI thread, in seconds.
+ */
 qreal Scene::dt () const
 {
     return d->dt;
 }
 
+/**
+ * Length of a simulation step, in seconds.
+ */
+qreal Scene::step () const
+{
+    return Simulation::step();
+}
+
+/**
+ * How far the frame being drawn is between the last two simulation steps.
+ *
+ * See Simulation::alpha().
+ */
+qreal Scene::alpha () const
+{
+    return d->alpha;
+}
+
 QScriptEngine* Scene::scriptEngine () const
 {
     return d->scriptEngine;
@@ -204,29 +360,7 @@ void Scene::initPhysics ()
 {
     sendStatusMessage("physics...");
 
-    d->collisionConfiguration = new btDefaultCollisionConfiguration();
-    Q_CHECK_PTR(d->collisionConfiguration);
-
-    d->dispatcher = new btCollisionDispatcher(d->collisionConfiguration);
-    Q_CHECK_PTR(d->dispatcher);
-
-    d->broadphaseInterface = new btDbvtBroadphase();
-    Q_CHECK_PTR(d->broadphaseInterface);
-
-    d->constraintSolver = new btSequentialImpulseConstraintSolver;
-    Q_CHECK_PTR(d->constraintSolver);
-
-    d->dynamicsWorld = new btDiscreteDynamicsWorld(
-        d->dispatcher,
-        d->broadphaseInterface,
-        d->constraintSolver,
-        d->collisionConfiguration
-        );
-    Q_CHECK_PTR(d->dynamicsWorld);
-
-    d->dynamicsWorld->setInternalTickCallback(internalTickCallback, this);
-
-    d->dynamicsWorld->setGravity(btVector3(0.f, -9.806f, 0.f));
+    d->simulation->start();
 }
 
 static
@@ -325,6 +459,7 @@ void Scene::initGraphics ()
 {
     sendStatusMessage("graphics...");
 
+    initGLDebug();
     glCheck();
 
     // sky
@@ -345,11 +480,28 @@ void Scene::initGraphics ()
     makeStarTex(64);
     loadShader(d->fyreworksShader, ":media/shaders/fyreworks.cg",
                "main_vp", "main_fp");
+    CGprogram fyreworks = d->fyreworksShader->program();
+    d->clusterShader.v0     = cgGetNamedParameter(fyreworks, "v0");
+    d->clusterShader.t      = cgGetNamedParameter(fyreworks, "t");
+    d->clusterShader.nt     = cgGetNamedParameter(fyreworks, "nt");
+    d->clusterShader.origin = cgGetNamedParameter(fyreworks, "origin");
+    d->clusterShader.eye    = cgGetNamedParameter(fyreworks, "eye");
 
     // shells
     loadShader(d->debugNormalsShader, ":media/shaders/debugNormals.cg",
                "main_vp", "main_fp");
 
+    // spectrum
+    makeSpectrumTex();
+    makeSpectrogramTex();
+    loadShader(d->spectrogramShader, ":media/shaders/spectrogram.cg",
+               "main_vp", "main_fp");
+    d->spectrogramOffset = cgGetNamedParameter(
+        d->spectrogramShader->program(), "offset");
+
+    d->pacer.setSwapInterval(
+        QGLContext::currentContext()->format().swapInterval());
+
     glCheck();
 }
 
@@ -361,6 +513,34 @@ void Scene::drawBackground (QPainter* painter, const QRectF&)
 
     Q_ASSERT(QGLContext::currentContext()->isValid());
 
+    render(painter, sceneRect().size().toSize());
+
+    // the swap follows, synced or not, so this is as close as it gets
+    d->pacer.presented(d->frameTimer.nsecsElapsed());
+}
+
+/**
+ * Draw one frame of @a size into the current context.
+ *
+ * Called by drawBackground(), or by a RenderThread that keeps the context
+ * to itself.  Whatever comes from the GUI thread is taken from the last
+ * FrameInput it published.
+ *
+ * @warning render thread only
+ */
+void Scene::render (QPainter* painter, const QSize& size)
+{
+    if (d->frameClock.isValid()) {
+        qreal realDt = 1e-9 * d->frameClock.nsecsElapsed();
+        expMovAvg(d->frameDt, realDt, 120);
+        d->fpsGraph->addSample(realDt, d->frameDt);
+        d->renderFps = qRound(1.0 / d->frameDt);
+    }
+    d->frameClock.start();
+
+    d->frameTimer.start();
+    d->viewport = size;
+
     painter->beginNativePainting();
 
     glEnable(GL_DEPTH_TEST);
@@ -368,9 +548,8 @@ void Scene::drawBackground (QPainter* painter, const QRectF&)
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluPerspective(45.0, qreal(width())/height(), 0.01, 1000.0);
-    d->camera->setMaxDistance(1000.0);
-    d->camera->setFocus(btVector3(0, 50, 0));
+    gluPerspective(45.0, qreal(size.width())/qMax(1, size.height()),
+                   0.01, 1000.0);
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -378,114 +557,425 @@ void Scene::drawBackground (QPainter* painter, const QRectF&)
     draw();
 
     painter->endNativePainting();
+
+    measureRenderLatency();
+    drawLatency(painter, size);
 }
 
-void Scene::draw ()
+/**
+ * Whether a RenderThread draws the frames, instead of drawBackground().
+ *
+ * The render thread paces its own frames then, and the GUI thread only
+ * ticks once per refresh interval to feed it.
+ */
+void Scene::setRenderThreaded (bool threaded)
 {
-    Q_ASSERT(soundEngine);
+    d->renderThreaded = threaded;
+    d->pacer.cancel();
+}
+
+/**
+ * Estimate how long after it is drawn a frame is seen.
+ *
+ * That is the time it took to submit, plus one frame interval waiting in
+ * the swap chain for the next vertical blank.
+ */
+void Scene::measureRenderLatency ()
+{
+    qreal submit = 1e-6 * d->frameTimer.nsecsElapsed();
+    expMovAvg(d->renderLatency, submit + 1000.0 * d->frameDt,
+              RENDER_LATENCY_FRAMES);
+    d->renderLatencyUs = qRound(1000.0 * d->renderLatency);
+}
 
+/**
+ * Print the audio and render latencies under the FPSGraph.
+ */
+void Scene::drawLatency (QPainter* painter, const QSize& size)
+{
+    const FrameInput& input (d->input.front());
+
+    QString text (tr("audio %0 ms  video %1 ms  sync %2%3 ms"));
+    text = text.arg(qRound(input.outputLatency));
+    text = text.arg(qRound(d->renderLatency));
+    int offset = qRound(input.syncOffset);
+    text = text.arg(offset < 0 ? "" : "+").arg(offset);
+
+    painter->save();
+    painter->setPen(Qt::white);
+    painter->drawText(QRectF(0, 64, size.width() - 4, 20),
+                      Qt::AlignRight | Qt::AlignTop, text);
+    painter->restore();
+}
+
+void Scene::draw ()
+{
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    d->camera->invoke();
-    soundEngine->soundSystem()->set3DListenerAttributes(
-        0,
-        d->camera->position(),
-        d->camera->velocity(),
-        d->camera->forward(),
-        d->camera->up()
-        );
+    d->input.update();
+    d->simulation->update();
+    d->alpha = d->simulation->alpha();
+
+    float view[16];
+    d->input.front().view.getOpenGLMatrix(view);
+    glMultMatrixf(view);
+
+    updateSpectrumTextures();
+
+    // music reactive sky and stars sample this
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, d->spectrumTex);
+    glActiveTexture(GL_TEXTURE0);
 
     drawSceneShells();
     drawSky();
     drawSceneClusters();
     drawSpectrum();
-    d->fpsGraph->draw();
+    d->fpsGraph->draw(d->viewport);
 
     glCheck();
 }
 
 
-void Scene::launch ()
+/**
+ * Launch a shell that bursts after @a flightTime seconds.
+ */
+void Scene::launch (qreal flightTime)
+{
+    d->simulation->launch(Shell::randomLaunch(flightTime));
+}
+
+/**
+ * A shell burst, set off a cluster of stars.
+ *
+ * The shell script runs here, then the simulation takes over the aging.
+ * While hidden, shells still in flight burst into nothing.
+ */
+void Scene::on_simulation_exploded (const btVector3& origin)
 {
-    Shell* shell = new Shell(this);
-    connect(this, SIGNAL(drawShells()), shell, SLOT(draw()));
-    connect(this, SIGNAL(update(qreal)), shell, SLOT(update(qreal)));
+    if (d->powerState == HiddenState) {
+        return;
+    }
+
+    QList<QScriptProgram> programs = d->shellPrograms.values();
+    QScriptProgram shellProgram = programs[randi(programs.size())];
+    Cluster* cluster = new Cluster(origin, shellProgram, this);
+
+    int id = d->nextClusterId++;
+    {
+        QMutexLocker locker (&d->clusterMutex);
+        d->clusters.insert(id, cluster);
+    }
+    d->simulation->addCluster(id, cluster->lifetime());
 }
 
+/**
+ * Taken out under the lock, so it is not being drawn, deleted after.
+ */
+void Scene::on_simulation_clusterExpired (int id)
+{
+    Cluster* cluster;
+    {
+        QMutexLocker locker (&d->clusterMutex);
+        cluster = d->clusters.take(id);
+    }
+    delete cluster;
+}
+
+/**
+ * Copy @a from into @a to without sharing, so the audio thread never has to
+ * detach what it writes.
+ */
+static
+void copySpectrum (QVector<float>& to, const QVector<float>& from)
+{
+    to.resize(from.size());
+    qCopy(from.constBegin(), from.constEnd(), to.begin());
+}
+
+/**
+ * Hand the renderer what it needs from the GUI thread for its next frame.
+ */
+void Scene::publishInput ()
+{
+    Q_ASSERT(soundEngine);
+
+    FrameInput& input (d->input.back());
+    input.view = d->camera->view();
+    input.eye = d->camera->position();
+    for (int i = 0; i < 2; i++) {
+        copySpectrum(input.spectrum[i], soundEngine->spectrum(i));
+        copySpectrum(input.bands[i], soundEngine->bands(i));
+    }
+    copySpectrum(input.spectrumHistory, soundEngine->spectrumHistory());
+    input.spectrumFrame = soundEngine->spectrumFrame();
+    input.isPlaying = soundEngine->isPlaying();
+    input.outputLatency = soundEngine->outputLatency();
+    input.syncOffset = soundEngine->syncOffset();
+    d->input.publish();
+}
+
+/**
+ * One tick of the GUI thread, timed by the FramePacer for the next frame.
+ *
+ * A tick that comes too late for its vertical blank still feeds the
+ * renderer, but skips the repaint instead of delaying the frames after it.
+ * Unless active, ticks come at a fixed, slower rate.  With a render thread
+ * nothing is repainted here, and ticks come once per refresh interval.
+ */
 void Scene::on_timer_timeout ()
 {
-    qreal realDt = 0.001 * d->time.restart();
+    qreal realDt = 1e-9 * d->time.nsecsElapsed();
+    d->time.start();
     expMovAvg(d->dt, realDt, 120);
-    d->fpsGraph->addSample(realDt, d->dt);
+
+    d->camera->update();
+    soundEngine->setListener(
+        d->camera->position(),
+        d->camera->velocity(),
+        d->camera->forward(),
+        d->camera->up()
+        );
+    soundEngine->setRenderLatency(0.001 * int(d->renderLatencyUs));
+    publishInput();
+
+    if (telemetry) {
+        telemetry->post("render/fps", int(d->renderFps));
+    }
+
+    if (d->renderThreaded) {
+        d->timer->start(d->powerState == ActiveState
+                        ? int(d->pacer.refreshInterval() / 1000000)
+                        : d->powerState == IdleState ? IDLE_FRAME_INTERVAL
+                        : HIDDEN_TICK_INTERVAL);
+        return;
+    }
+
+    switch (d->powerState) {
+    case ActiveState: {
+        bool late = d->pacer.isLate();
+        d->timer->start(d->pacer.schedule());
+        if (late) {
+            d->pacer.drop();
+        } else {
+            QGraphicsScene::update();
+        }
+        break;
+    }
+    case IdleState:
+        d->pacer.cancel();
+        d->timer->start(IDLE_FRAME_INTERVAL);
+        QGraphicsScene::update();
+        break;
+    default:
+        d->pacer.cancel();
+        d->timer->start(HIDDEN_TICK_INTERVAL);
+        break;
+    }
+}
+
+/**
+ * Show the track and frame rate in the window title.
+ */
+void Scene::showTitle (const QVariantHash& changes)
+{
+    Q_UNUSED(changes);
 
     QWidget* widget = qobject_cast<QWidget*>(parent());
-    if (widget) {
-        widget->setWindowTitle(tr("FyreWare (%0 fps)").arg(int(1.0/d->dt)));
+    if (!widget) {
+        return;
+    }
+
+    QString title (tr("FyreWare (%0 fps)")
+                   .arg(telemetry->value("render/fps").toInt()));
+    QString track (telemetry->value("player/title").toString());
+    if (!track.isEmpty()) {
+        QString artist (telemetry->value("player/artist").toString());
+        if (!artist.isEmpty()) {
+            track = tr("%0 / %1").arg(artist, track);
+        }
+        title = tr("%0 - %1").arg(track, title);
+    }
+    widget->setWindowTitle(title);
+}
+
+void Scene::makeSpectrogramTex ()
+{
+    Q_ASSERT(d->spectrogramTex == 0);
+    glGenTextures(1, &d->spectrogramTex);
+    glBindTexture(GL_TEXTURE_2D, d->spectrogramTex);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    int size = SPECTROGRAM_HISTORY * soundEngine->spectrumLength() * 2;
+    QVector<float> img (size, 0.0f);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA,
+                 SPECTROGRAM_HISTORY, soundEngine->spectrumLength(), 0,
+                 GL_LUMINANCE_ALPHA, GL_FLOAT, img.data());
+}
+
+void Scene::makeSpectrumTex ()
+{
+    Q_ASSERT(d->spectrumTex == 0);
+    glGenTextures(1, &d->spectrumTex);
+    glBindTexture(GL_TEXTURE_1D, d->spectrumTex);
+
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+
+    d->spectrumBands.fill(0.0f, SPECTRUM_BANDS * 2);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_LUMINANCE_ALPHA, SPECTRUM_BANDS, 0,
+                 GL_LUMINANCE_ALPHA, GL_FLOAT, d->spectrumBands.constData());
+}
+
+/**
+ * Bring the spectrum textures up to date, once per frame.
+ */
+void Scene::updateSpectrumTextures ()
+{
+    const FrameInput& input (d->input.front());
+    quint32 frame = input.spectrumFrame;
+    int count = qMin(int(frame - d->spectrogramFrame), SPECTRUM_HISTORY);
+    d->spectrogramFrame = frame;
+    if (count <= 0 || input.bands[0].size() < SPECTRUM_BANDS) {
+        return;
     }
 
-    // calling stepSimulation eventually leads to internalTickCallback,
-    // which eventually emits update signal
-    if (d->dynamicsWorld) {
-        d->dynamicsWorld->stepSimulation(d->dt);
+    // bands
+    const float* bands0 = input.bands[0].constData();
+    const float* bands1 = input.bands[1].constData();
+    float* out = d->spectrumBands.data();
+    for (int i = 0; i < SPECTRUM_BANDS; i++) {
+        *out++ = bands0[i];
+        *out++ = bands1[i];
     }
+    glBindTexture(GL_TEXTURE_1D, d->spectrumTex);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, SPECTRUM_BANDS,
+                    GL_LUMINANCE_ALPHA, GL_FLOAT,
+                    d->spectrumBands.constData());
 
-    //updateGL();
-    QGraphicsScene::update();
+    updateSpectrogram(count);
+}
+
+/**
+ * Upload the spectrum of each of the last @a count spectrum updates.
+ *
+ * The audio thread keeps the last SPECTRUM_HISTORY of them.  Should more
+ * have been missed, the older ones are left out, and the scroll falls
+ * behind for a moment rather than showing made up columns.
+ */
+void Scene::updateSpectrogram (int count)
+{
+    const FrameInput& input (d->input.front());
+    const int column = SPECTRUM_LENGTH * 2;
+    if (input.spectrumHistory.size() < SPECTRUM_HISTORY * column) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, d->spectrogramTex);
+
+    for (quint32 f = input.spectrumFrame - count + 1;
+         f != input.spectrumFrame + 1; f++) {
+        const float* spectrum = input.spectrumHistory.constData()
+            + (f % SPECTRUM_HISTORY) * column;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, d->spectrogramHead, 0,
+                        1, SPECTRUM_LENGTH, GL_LUMINANCE_ALPHA, GL_FLOAT,
+                        spectrum);
+
+        d->spectrogramHead++;
+        d->spectrogramHead %= SPECTROGRAM_HISTORY;
+    }
 }
 
 void Scene::drawSpectrum ()
 {
-    if (!soundEngine->isPlaying()) {
+    if (!d->input.front().isPlaying || d->spectrogramShader->isNull()) {
         return;
     }
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    glOrtho(0, soundEngine->spectrumLength() * 2, 0, SPECTRUM_HEIGHT, -1, 1);
+    glOrtho(0, 1, 0, 1, -1, 1);
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    glColor3f(0, 1, 1);
-    glBegin(GL_LINE_STRIP);
-    for (int i = 0; i < soundEngine->spectrumLength(); i++) {
-        glVertex2f(i,
-                   soundEngine->spectrum(0)[i]);
-    }
-    glEnd();
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
 
-    glColor3f(1, 0, 0);
-    glBegin(GL_LINE_STRIP);
-    for (int i = 0; i < soundEngine->spectrumLength(); i++) {
-        /// @todo perfect horizontal alignment
-        glVertex2f(soundEngine->spectrumLength() * 2 - i - 1,
-                   soundEngine->spectrum(1)[i]);
-    }
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+    glBindTexture(GL_TEXTURE_2D, d->spectrogramTex);
+
+    // from the center of the oldest column to that of the newest, so the
+    // filtering never blends the two across the seam of the ring
+    const float first = 0.5f / SPECTROGRAM_HISTORY;
+    const float last = 1.0f - first;
+
+    d->spectrogramShader->bind();
+    cgGLSetParameter1f(d->spectrogramOffset,
+                       qreal(d->spectrogramHead) / SPECTROGRAM_HISTORY);
+
+    glBegin(GL_QUADS);
+    glTexCoord2f(first, 0); glVertex2f(0, 0);
+    glTexCoord2f(last, 0);  glVertex2f(1, 0);
+    glTexCoord2f(last, 1);  glVertex2f(1, SPECTROGRAM_HEIGHT);
+    glTexCoord2f(first, 1); glVertex2f(0, SPECTROGRAM_HEIGHT);
     glEnd();
 
+    d->spectrogramShader->release();
+
+    glPopAttrib();
+
+    if (d->spectrogramShader->error() != CG_NO_ERROR) {
+        qCritical() << Q_FUNC_INFO << d->spectrogramShader->errorString();
+    }
 }
 
-void Scene::makeStarTex (int maxWidth)
+/**
+ * Fills rows of one star texture level.
+ */
+struct StarRows
 {
-    Q_ASSERT(d->starTex == 0);
-    glGenTextures(1, &d->starTex);
-    glBindTexture(GL_TEXTURE_2D, d->starTex);
+    float* img;
+    int width;
 
-    QVector<float> img;
-    img.reserve(maxWidth * maxWidth);
-    for (int width = maxWidth, level = 0; width > 0; width>>=1, level++) {
-        img.resize(0);
+    void operator() (int begin, int end)
+    {
         qreal radius = width >> 1;
         btVector3 center (radius, radius, 0.0f);
-        for (int y = 0; y < width; y++) {
+        float* out = img + begin * width;
+        for (int y = begin; y < end; y++) {
             for (int x = 0; x < width; x++) {
                 btVector3 p (x, y, 0.0f);
                 qreal distance = p.distance(center);
                 qreal zo = distance / radius;
-                img << (zo > 1.0 ? 0.0 : 1.0 - zo);
+                *out++ = zo > 1.0 ? 0.0 : 1.0 - zo;
             }
         }
+    }
+};
+
+void Scene::makeStarTex (int maxWidth)
+{
+    Q_ASSERT(d->starTex == 0);
+    glGenTextures(1, &d->starTex);
+    glBindTexture(GL_TEXTURE_2D, d->starTex);
+
+    QVector<float> img;
+    img.reserve(maxWidth * maxWidth);
+    for (int width = maxWidth, level = 0; width > 0; width>>=1, level++) {
+        img.resize(width * width);
+        qreal radius = width >> 1;
+        StarRows rows = { img.data(), width };
+        parallelFor("star texture", 0, width, 16, rows);
 
         if (qFuzzyCompare(radius, 0.0)) {
             img[0] = 1.0;
@@ -508,11 +998,22 @@ void Scene::makeStarTex (int maxWidth)
     }
 }
 
+/**
+ * Decodes cube map faces and scales their mipmaps.
+ */
 struct ImageLoader
 {
-    typedef QList<QImage> result_type;
+    const QStringList* paths;
+    QList<QImage>* faces;
+
+    void operator() (int begin, int end)
+    {
+        for (int i = begin; i < end; i++) {
+            faces[i] = load(paths->at(i));
+        }
+    }
 
-    result_type operator() (const QString& path)
+    static QList<QImage> load (const QString& path)
     {
         QImage img (path);
 
@@ -566,10 +1067,9 @@ void Scene::loadCubeMap (const QDir& path)
         << path.filePath("negy.jpg") << path.filePath("posy.jpg")
         << path.filePath("posz.jpg") << path.filePath("negz.jpg")
         ;
-    QFuture<QList<QImage> > future =
-        QtConcurrent::mapped(imagePaths, ImageLoader());
-    future.waitForFinished();
-    QList<QList<QImage> > images (future.results());
+    QVector<QList<QImage> > images (imagePaths.size());
+    ImageLoader loader = { &imagePaths, images.data() };
+    parallelFor("sky faces", 0, imagePaths.size(), 1, loader);
 
     qDebug() << t0.restart() << "ms loading sky";
 
@@ -608,12 +1108,11 @@ void Scene::drawSky ()
 
     d->skyShader->bind();
 
+    const btVector3& eye (d->input.front().eye);
     glPushMatrix();
-    glTranslated(d->camera->position().x(),
-                 d->camera->position().y(),
-                 d->camera->position().z());
+    glTranslated(eye.x(), eye.y(), eye.z());
     static GLuint dlist = 0;
-    if (glIsList(dlist)) {
+    if (dlist) {
         glCallList(dlist);
     } else {
         dlist = glGenLists(1);
@@ -708,7 +1207,10 @@ void Scene::drawSceneShells ()
     }
 
     d->debugNormalsShader->bind();
-    emit drawShells();
+    const SimulationSnapshot& snapshot (d->simulation->snapshot());
+    foreach (const ShellSnapshot& shell, snapshot.shells) {
+        Shell::draw(shell.previous, shell.current, d->alpha);
+    }
     d->debugNormalsShader->release();
 
     if (d->debugNormalsShader->error() != CG_NO_ERROR) {
@@ -737,7 +1239,18 @@ void Scene::drawSceneClusters ()
     glBindTexture(GL_TEXTURE_2D, d->starTex);
 
     d->fyreworksShader->bind();
-    emit drawClusters();
+    {
+        QMutexLocker locker (&d->clusterMutex);
+        const SimulationSnapshot& snapshot (d->simulation->snapshot());
+        foreach (const ClusterSnapshot& state, snapshot.clusters) {
+            Cluster* cluster = d->clusters.value(state.id);
+            if (cluster) {
+                cluster->draw(state.previousAge
+                              + (state.age - state.previousAge) * d->alpha,
+                              d->clusterShader);
+            }
+        }
+    }
     d->fyreworksShader->release();
 
     glDepthMask(GL_TRUE);
@@ -748,12 +1261,3 @@ void Scene::drawSceneClusters ()
         qCritical() << Q_FUNC_INFO << d->fyreworksShader->errorString();
     }
 }
-
-/**
- * Bullet callback.
- */
-void Scene::internalTickCallback (btDynamicsWorld* world, btScalar timeStep)
-{
-    Scene* scene = static_cast<Scene*>(world->getWorldUserInfo());
-    emit scene->update(timeStep);
-}
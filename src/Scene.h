@@ -23,17 +23,19 @@
 
 #include <QGraphicsScene>
 #include <QPointer>
+#include <QVariant>
 
 #include "Scene.h"
-
-#include <btBulletDynamicsCommon.h>
+#include "PowerManager.h"
 
 class QDir;
+class QSize;
 class QScriptEngine;
 class QScriptProgram;
 
 class Camera;
 class ShaderProgram;
+class btVector3;
 
 class Scene : public QGraphicsScene
 {
@@ -45,29 +47,43 @@ public:
 
     void start ();
 
-    btDynamicsWorld* dynamicsWorld () const;
-
     ShaderProgram* shader (const QString& name) const;
     Camera* camera () const;
+    btVector3 eye () const;
+
+    uint spectrogramTexture () const;
+    uint spectrumTexture () const;
 
     qreal dt () const;
+    qreal step () const;
+    qreal alpha () const;
 
     QScriptEngine* scriptEngine () const;
 
-    void launch ();
+    void launch (qreal flightTime);
 
     QScriptProgram analyzerProgram () const;
     QHash<QString, QScriptProgram> shellPrograms () const;
 
+    void render (QPainter* painter, const QSize& size);
+    void setRenderThreaded (bool threaded);
+
+public slots:
+    void setPowerState (PowerState state);
+
 signals:
-    void drawShells ();
-    void drawClusters ();
-    void update (qreal dt);
     void statusMessage (const QString&, int, const QColor&);
 
 private:
     void loadCubeMap (const QDir& path);
     void makeStarTex (int maxWidth);
+    void makeSpectrogramTex ();
+    void makeSpectrumTex ();
+    void updateSpectrumTextures ();
+    void updateSpectrogram (int count);
+    void measureRenderLatency ();
+    void drawLatency (QPainter* painter, const QSize& size);
+    void publishInput ();
 
     void initPhysics ();
     void initSound ();
@@ -90,13 +106,13 @@ private:
     //void pinchGesture (QPinchGesture* gesture);
     //void swipeGesture (QSwipeGesture* gesture);
 
-    static void internalTickCallback (
-        btDynamicsWorld* world, btScalar timeStep);
-
     void drawBackground (QPainter* painter, const QRectF&);
 
 private slots:
     void on_timer_timeout ();
+    void showTitle (const QVariantHash& changes);
+    void on_simulation_exploded (const btVector3& origin);
+    void on_simulation_clusterExpired (int id);
 
 private:
     struct Private;
@@ -1,4 +1,3 @@
-
 /**
  * @file Shell.cpp
  * @brief Shell implementation
@@ -6,54 +5,69 @@
 
 #include "defs.h"
 
-#include "Shell.moc"
-
-#include "Cluster.h"
-#include "Scene.h"
+#include "Shell.h"
+#include "Simulation.h"
 
 #include <btBulletDynamicsCommon.h>
 
 #include <QDebug>
 #include <QGLWidget>
-#include <QScriptProgram>
+
+/**
+ * Drawn radius of a shell, in meters.
+ *
+ * 1 meter is really huge, but visible.
+ */
+#define SHELL_RADIUS 1.0
+
+/**
+ * @class Shell
+ *
+ * @brief a rigid body climbing until it bursts
+ *
+ * Lives in the simulation thread.  Bullet moves it once per step through
+ * setWorldTransform(), and it keeps the transform from the step before, so
+ * the renderer can draw it in between.
+ */
 
 struct Shell::Private
 {
-    qreal radius;
+    btDynamicsWorld* world;
     btCollisionShape* shape;  ///< @todo Individual shapes is unnecessary.
     btRigidBody* rigidBody;
     btTransform trx;
+    btTransform previousTrx;    ///< as of the step before
     qreal lifetime;
     qreal age;
 
-    Private (Shell* q) :
-        radius(1.0),  // 1 meter is really huge, but visible
+    Private (btDynamicsWorld* world) :
+        world(world),
         shape(NULL),
         rigidBody(NULL),
         trx(btQuaternion::getIdentity(), btVector3(0, 0, 0)),
+        previousTrx(trx),
         lifetime(1.0),
         age(0)
     {
-        Q_UNUSED(q);
     }
 };
 
-Shell::Shell (QObject* parent) :
-    QObject(parent),
-    d(new Private(this))
+/**
+ * @warning simulation thread only
+ */
+Shell::Shell (btDynamicsWorld* world, const ShellLaunch& launch) :
+    d(new Private(world))
 {
     btScalar mass = 1.0;
 
     btVector3 inertia (0, 0, 0);
-    d->shape = new btSphereShape(d->radius);
+    d->shape = new btSphereShape(SHELL_RADIUS);
     Q_CHECK_PTR(d->shape);
 
     d->shape->calculateLocalInertia(mass, inertia);
 
-    d->trx.setOrigin(btVector3(
-            randf(-50, 50),
-            0.0,
-            randf(-50, 50)));
+    d->trx.setOrigin(launch.origin);
+    d->previousTrx = d->trx;
 
     btRigidBody::btRigidBodyConstructionInfo conInfo (
         mass, this, d->shape, inertia);
@@ -61,52 +75,114 @@ Shell::Shell (QObject* parent) :
     d->rigidBody = new btRigidBody(conInfo);
     Q_CHECK_PTR(d->rigidBody);
 
-    scene->dynamicsWorld()->addRigidBody(d->rigidBody);
+    d->world->addRigidBody(d->rigidBody);
 
-    // shooting for a height of about 100 meters
-    d->rigidBody->applyCentralImpulse(btVector3(
-            randf(-20, 20),
-            randf(60, 80),
-            randf(-20, 20)));
+    d->rigidBody->applyCentralImpulse(launch.impulse);
 
-    d->lifetime = randf(1.5, 2.0);
+    d->lifetime = launch.flightTime;
 
     //qDebug() << "v" << d->rigidBody->getLinearVelocity().length();
 }
 
 Shell::~Shell ()
 {
+    d->world->removeRigidBody(d->rigidBody);
     delete d->rigidBody;
     delete d->shape;
 }
 
+qreal Shell::randomFlightTime ()
+{
+    return randf(SHELL_MIN_FLIGHT_TIME, SHELL_MAX_FLIGHT_TIME);
+}
+
+/**
+ * Pick where and how hard to shoot a shell.
+ *
+ * Done by the launching thread, so the simulation itself stays free of
+ * randomness.
+ */
+ShellLaunch Shell::randomLaunch (qreal flightTime)
+{
+    ShellLaunch launch;
+    launch.origin = btVector3(
+        randf(-50, 50),
+        0.0,
+        randf(-50, 50));
+
+    // shooting for a height of about 100 meters
+    launch.impulse = btVector3(
+        randf(-20, 20),
+        randf(60, 80),
+        randf(-20, 20));
+
+    launch.flightTime = flightTime;
+    return launch;
+}
+
 void Shell::getWorldTransform (btTransform& trx) const
 {
     trx = d->trx;
 }
 
+/**
+ * Called by Bullet once per simulation step.
+ */
 void Shell::setWorldTransform (const btTransform& trx)
 {
+    d->previousTrx = d->trx;
     d->trx = trx;
 }
 
-void Shell::draw ()
+const btTransform& Shell::transform () const
+{
+    return d->trx;
+}
+
+const btTransform& Shell::previousTransform () const
+{
+    return d->previousTrx;
+}
+
+/**
+ * Age by @a dt seconds.
+ *
+ * @return false once the shell bursts
+ */
+bool Shell::advance (qreal dt)
+{
+    if (d->age >= d->lifetime) {
+        return false;
+    }
+    d->age += dt;
+    return true;
+}
+
+/**
+ * Draw a shell @a alpha of the way from @a previous to @a current.
+ */
+void Shell::draw (const btTransform& previous, const btTransform& current,
+                  btScalar alpha)
 {
     glPushMatrix();
 
+    btTransform trx;
+    trx.setOrigin(previous.getOrigin().lerp(current.getOrigin(), alpha));
+    trx.setRotation(previous.getRotation().slerp(current.getRotation(), alpha));
+
     float m[16];
-    d->trx.getOpenGLMatrix(m);
+    trx.getOpenGLMatrix(m);
     glMultMatrixf(m);
 
     static GLuint dlist = 0;
-    if (glIsList(dlist)) {
+    if (dlist) {
         glCallList(dlist);
     } else {
         dlist = glGenLists(1);
         glNewList(dlist, GL_COMPILE_AND_EXECUTE);
 
         GLUquadric* quadric = gluNewQuadric();
-        gluSphere(quadric, d->radius, 3, 3);
+        gluSphere(quadric, SHELL_RADIUS, 3, 3);
         gluDeleteQuadric(quadric);
 
         glEndList();
@@ -114,23 +190,3 @@ void Shell::draw ()
 
     glPopMatrix();
 }
-
-void Shell::update (qreal dt)
-{
-    if (d->age >= d->lifetime) {
-        explode();
-        scene->dynamicsWorld()->removeRigidBody(d->rigidBody);
-        deleteLater();
-    } else {
-        d->age += dt;
-    }
-}
-
-void Shell::explode ()
-{
-    QList<QScriptProgram> programs = scene->shellPrograms().values();
-    QScriptProgram shellProgram = programs[randi(programs.size())];
-    Cluster* cluster = new Cluster(d->trx.getOrigin(), shellProgram, scene);
-    connect(scene, SIGNAL(update(qreal)), cluster, SLOT(update(qreal)));
-    connect(scene, SIGNAL(drawClusters()), cluster, SLOT(draw()));
-}
@@ -1,4 +1,3 @@
-
 /**
  * @file Shell.h
  * @brief Shell definition
@@ -6,27 +5,42 @@
 
 #pragma once
 
-#include <QObject>
+#include <QScopedPointer>
 
 #include <LinearMath/btMotionState.h>
 
-class Shell : public QObject, public btMotionState
-{
-    Q_OBJECT
+class btDynamicsWorld;
+struct ShellLaunch;
+
+/**
+ * @name flight time
+ *
+ * How long a shell climbs before it bursts, in seconds.
+ */
+//@{
+#define SHELL_MIN_FLIGHT_TIME 1.5
+#define SHELL_MAX_FLIGHT_TIME 2.0
+//@}
 
+class Shell : public btMotionState
+{
 public:
-    Shell (QObject* parent = NULL);
+    Shell (btDynamicsWorld* world, const ShellLaunch& launch);
     virtual ~Shell ();
 
+    static qreal randomFlightTime ();
+    static ShellLaunch randomLaunch (qreal flightTime);
+
     void getWorldTransform (btTransform& trx) const;
     void setWorldTransform (const btTransform& trx);
 
-public slots:
-    void draw ();
-    void update (qreal dt);
+    const btTransform& transform () const;
+    const btTransform& previousTransform () const;
 
-private:
-    void explode ();
+    bool advance (qreal dt);
+
+    static void draw (const btTransform& previous, const btTransform& current,
+                      btScalar alpha);
 
 private:
     struct Private;
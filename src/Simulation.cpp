@@ -0,0 +1,396 @@
+/**
+ * @file Simulation.cpp
+ * @brief Simulation implementation
+ */
+
+#include "Simulation.moc"
+
+#include "defs.h"
+#include "Shell.h"
+#include "TripleBuffer.h"
+#include "ThreadManager.h"
+
+#include <btBulletDynamicsCommon.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <QDebug>
+
+/**
+ * Length of one simulation step, in seconds.
+ */
+#define SIMULATION_STEP (1.0 / 120.0)
+
+/**
+ * Most simulation steps taken to catch up at once.
+ *
+ * Anything beyond that is dropped, so a long hitch slows the simulation
+ * down for a moment instead of stalling every step after it.
+ */
+#define MAX_CATCH_UP_STEPS 8
+
+/**
+ * @class Simulation
+ *
+ * @brief steps the physics, shells and cluster ages on their own thread
+ *
+ * The world advances in fixed SIMULATION_STEP steps against a monotonic
+ * clock, and after every batch of steps a SimulationSnapshot is published
+ * through a TripleBuffer.  The renderer takes the newest one without locking
+ * and draws between its two states, by alpha().
+ *
+ * While nobody is watching, setStepMultiple() makes the steps longer and
+ * fewer, which is where the simulation's CPU time goes down.
+ *
+ * Bursts go back to the GUI thread through exploded(), since the cluster
+ * scripts run there.  The GUI then hands the cluster's id back through
+ * addCluster(), and gets clusterExpired() once it burnt out.
+ */
+
+namespace
+{
+
+struct Command
+{
+    enum Type
+    {
+        Launch,
+        AddCluster
+    };
+
+    Type type;
+    ShellLaunch launch;
+    int id;
+    qreal lifetime;
+};
+
+struct ClusterAge
+{
+    int id;
+    qreal lifetime;
+    qreal previousAge;
+    qreal age;
+};
+
+} // namespace
+
+struct Simulation::Private
+{
+    Simulation* q;
+
+    QElapsedTimer clock;        ///< shared by both threads, read only
+    QAtomicInt stopped;
+    QAtomicInt stepMultiple;
+
+    QMutex mutex;
+    QQueue<Command> commands;
+
+    btDefaultCollisionConfiguration* collisionConfiguration;
+    btCollisionDispatcher* dispatcher;
+    btBroadphaseInterface* broadphaseInterface;
+    btConstraintSolver* constraintSolver;
+    btDynamicsWorld* dynamicsWorld;
+
+    QList<Shell*> shells;
+    QList<ClusterAge> clusters;
+
+    TripleBuffer<SimulationSnapshot> snapshot;
+
+    Private (Simulation* q) :
+        q(q),
+        stopped(0),
+        stepMultiple(1),
+        collisionConfiguration(NULL),
+        dispatcher(NULL),
+        broadphaseInterface(NULL),
+        constraintSolver(NULL),
+        dynamicsWorld(NULL)
+    {
+        clock.start();
+    }
+
+    void post (const Command& cmd);
+    void execute (const Command& cmd);
+
+    void initPhysics ();
+    void freePhysics ();
+    void advance (qreal step);
+    void publish (qreal time, qreal step);
+};
+
+Simulation::Simulation (QObject* parent) :
+    QThread(parent),
+    d(new Private(this))
+{
+    qRegisterMetaType<btVector3>("btVector3");
+}
+
+Simulation::~Simulation ()
+{
+    stop();
+    wait();
+}
+
+/**
+ * Length of one simulation step, in seconds.
+ */
+qreal Simulation::step ()
+{
+    return SIMULATION_STEP;
+}
+
+/**
+ * @warning any thread
+ */
+void Simulation::Private::post (const Command& cmd)
+{
+    QMutexLocker locker (&mutex);
+    commands.enqueue(cmd);
+}
+
+void Simulation::launch (const ShellLaunch& launch)
+{
+    Command cmd;
+    cmd.type = Command::Launch;
+    cmd.launch = launch;
+    d->post(cmd);
+}
+
+/**
+ * Age cluster @a id until @a lifetime seconds, then emit clusterExpired().
+ */
+void Simulation::addCluster (int id, qreal lifetime)
+{
+    Command cmd;
+    cmd.type = Command::AddCluster;
+    cmd.id = id;
+    cmd.lifetime = lifetime;
+    d->post(cmd);
+}
+
+void Simulation::stop ()
+{
+    d->stopped = 1;
+}
+
+/**
+ * Step @a multiple times SIMULATION_STEP at once, e.g. while nobody watches.
+ *
+ * Bullet does that much less work, but less accurately, and the renderer
+ * gets a new state only every @a multiple steps.  At most
+ * MAX_CATCH_UP_STEPS.
+ *
+ * @warning any thread
+ */
+void Simulation::setStepMultiple (int multiple)
+{
+    d->stepMultiple = qBound(1, multiple, MAX_CATCH_UP_STEPS);
+}
+
+/**
+ * Fetch the newest snapshot published by the simulation thread.
+ *
+ * @warning render thread only
+ */
+bool Simulation::update ()
+{
+    return d->snapshot.update();
+}
+
+/**
+ * @warning render thread only
+ */
+const SimulationSnapshot& Simulation::snapshot () const
+{
+    return d->snapshot.front();
+}
+
+/**
+ * How far the present is past snapshot(), in steps.
+ *
+ * In [0, 1].  Drawing blends the previous and current states by this, which
+ * keeps rendering one step behind the simulation, but smooth.
+ *
+ * @warning render thread only
+ */
+qreal Simulation::alpha () const
+{
+    qreal now = 1e-9 * d->clock.nsecsElapsed();
+    qreal step = qMax(snapshot().step, SIMULATION_STEP);
+    qreal alpha = (now - snapshot().time) / step;
+    return qBound(0.0, alpha, 1.0);
+}
+
+/**
+ * @warning Runs in its own thread.
+ */
+void Simulation::run ()
+{
+    if (threadManager) {
+        threadManager->enter(SimulationRole, "simulation");
+    }
+
+    d->initPhysics();
+
+    qreal simulated = 1e-9 * d->clock.nsecsElapsed();
+
+    while (!d->stopped) {
+        // take the commands, run them without holding the lock
+        QQueue<Command> commands;
+        {
+            QMutexLocker locker (&d->mutex);
+            commands = d->commands;
+            d->commands.clear();
+        }
+        while (!commands.isEmpty()) {
+            d->execute(commands.dequeue());
+        }
+
+        qreal step = int(d->stepMultiple) * SIMULATION_STEP;
+        qreal now = 1e-9 * d->clock.nsecsElapsed();
+        simulated = qMax(simulated, now - MAX_CATCH_UP_STEPS * step);
+
+        bool stepped = false;
+        while (simulated + step <= now) {
+            d->advance(step);
+            simulated += step;
+            stepped = true;
+        }
+        if (stepped) {
+            d->publish(simulated, step);
+        }
+
+        // until the next step is due
+        qreal wait = simulated + step - 1e-9 * d->clock.nsecsElapsed();
+        if (wait > 0.0) {
+            usleep(wait * 1e6);
+        }
+    }
+
+    qDeleteAll(d->shells);
+    d->shells.clear();
+    d->freePhysics();
+}
+
+/**
+ * @warning simulation thread only
+ */
+void Simulation::Private::execute (const Command& cmd)
+{
+    switch (cmd.type) {
+    case Command::Launch:
+        shells << new Shell(dynamicsWorld, cmd.launch);
+        break;
+    case Command::AddCluster: {
+        ClusterAge cluster = { cmd.id, cmd.lifetime, 0.0, 0.0 };
+        clusters << cluster;
+        break;
+    }
+    }
+}
+
+void Simulation::Private::initPhysics ()
+{
+    collisionConfiguration = new btDefaultCollisionConfiguration();
+    Q_CHECK_PTR(collisionConfiguration);
+
+    dispatcher = new btCollisionDispatcher(collisionConfiguration);
+    Q_CHECK_PTR(dispatcher);
+
+    broadphaseInterface = new btDbvtBroadphase();
+    Q_CHECK_PTR(broadphaseInterface);
+
+    constraintSolver = new btSequentialImpulseConstraintSolver;
+    Q_CHECK_PTR(constraintSolver);
+
+    dynamicsWorld = new btDiscreteDynamicsWorld(
+        dispatcher,
+        broadphaseInterface,
+        constraintSolver,
+        collisionConfiguration
+        );
+    Q_CHECK_PTR(dynamicsWorld);
+
+    dynamicsWorld->setGravity(btVector3(0.f, -9.806f, 0.f));
+}
+
+void Simulation::Private::freePhysics ()
+{
+    delete dynamicsWorld;
+    delete constraintSolver;
+    delete broadphaseInterface;
+    delete dispatcher;
+    delete collisionConfiguration;
+    dynamicsWorld = NULL;
+}
+
+/**
+ * One step of everything.
+ *
+ * An empty world is not stepped, there is nothing for Bullet to do.
+ *
+ * @param[in] step length, in seconds
+ *
+ * @warning simulation thread only
+ */
+void Simulation::Private::advance (qreal step)
+{
+    if (dynamicsWorld->getNumCollisionObjects() > 0) {
+        dynamicsWorld->stepSimulation(step, 0);
+    }
+
+    QList<Shell*>::iterator shell = shells.begin();
+    while (shell != shells.end()) {
+        if ((*shell)->advance(step)) {
+            ++shell;
+            continue;
+        }
+        emit q->exploded((*shell)->transform().getOrigin());
+        delete *shell;
+        shell = shells.erase(shell);
+    }
+
+    QList<ClusterAge>::iterator cluster = clusters.begin();
+    while (cluster != clusters.end()) {
+        if (cluster->age < cluster->lifetime) {
+            cluster->previousAge = cluster->age;
+            cluster->age += step;
+            ++cluster;
+            continue;
+        }
+        emit q->clusterExpired(cluster->id);
+        cluster = clusters.erase(cluster);
+    }
+}
+
+/**
+ * @param[in] time simulated so far, on the clock
+ * @param[in] step length of the last step, in seconds
+ */
+void Simulation::Private::publish (qreal time, qreal step)
+{
+    SimulationSnapshot& out = snapshot.back();
+    out.time = time;
+    out.step = step;
+
+    out.shells.resize(shells.size());
+    ShellSnapshot* shellOut = out.shells.data();
+    foreach (Shell* shell, shells) {
+        shellOut->previous = shell->previousTransform();
+        shellOut->current = shell->transform();
+        shellOut++;
+    }
+
+    out.clusters.resize(clusters.size());
+    ClusterSnapshot* clusterOut = out.clusters.data();
+    foreach (const ClusterAge& cluster, clusters) {
+        clusterOut->id = cluster.id;
+        clusterOut->previousAge = cluster.previousAge;
+        clusterOut->age = cluster.age;
+        clusterOut++;
+    }
+
+    snapshot.publish();
+}
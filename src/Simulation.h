@@ -0,0 +1,103 @@
+/**
+ * @file Simulation.h
+ * @brief Simulation definition
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QVector>
+
+#include <LinearMath/btTransform.h>
+
+/**
+ * Where and how hard a shell is shot.
+ */
+struct ShellLaunch
+{
+    btVector3 origin;
+    btVector3 impulse;
+    qreal flightTime;           ///< until it bursts, in seconds
+};
+
+/**
+ * A shell as of the last two steps.
+ */
+struct ShellSnapshot
+{
+    btTransform previous;
+    btTransform current;
+};
+
+/**
+ * A cluster as of the last two steps.
+ */
+struct ClusterSnapshot
+{
+    int id;                     ///< as passed to Simulation::addCluster()
+    qreal previousAge;          ///< in seconds
+    qreal age;                  ///< in seconds
+};
+
+/**
+ * What the simulation thread last stepped to, as handed to the renderer.
+ */
+struct SimulationSnapshot
+{
+    qreal time;                 ///< of the current states, in seconds
+    qreal step;                 ///< between the two states, in seconds
+    QVector<ShellSnapshot> shells;
+    QVector<ClusterSnapshot> clusters;
+
+    SimulationSnapshot () :
+        time(0.0),
+        step(0.0)
+    {
+    }
+};
+
+class Simulation : public QThread
+{
+    Q_OBJECT
+
+public:
+    Simulation (QObject* parent = NULL);
+    virtual ~Simulation ();
+
+    static qreal step ();
+
+    /**
+     * @name commands
+     *
+     * Queued, and carried out by the simulation thread.
+     */
+    //@{
+    void launch (const ShellLaunch& launch);
+    void addCluster (int id, qreal lifetime);
+    void stop ();
+    //@}
+
+    void setStepMultiple (int multiple);
+
+    bool update ();
+    const SimulationSnapshot& snapshot () const;
+    qreal alpha () const;
+
+signals:
+    /**
+     * A shell burst at @a origin.
+     */
+    void exploded (const btVector3& origin);
+
+    /**
+     * Cluster @a id burnt out.
+     */
+    void clusterExpired (int id);
+
+protected:
+    void run ();
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
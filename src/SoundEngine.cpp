@@ -10,20 +10,20 @@
 #include "scripting.h"
 #include "Scene.h"
 #include "Playlist.h"
-
-#include <QtFMOD/System.h>
-#include <QtFMOD/Channel.h>
-#include <QtFMOD/Sound.h>
-
+#include "Shell.h"
+#include "Analysis.h"
+#include "Lookahead.h"
+#include "AnalysisCache.h"
+#include "AudioThread.h"
+#include "AnalysisShare.h"
+#include "FeatureGraph.h"
+#include "Telemetry.h"
+#include "ThreadManager.h"
+
+#include <QRunnable>
 #include <QDebug>
 #include <QScriptEngine>
-
-#define fsysCheck()                                                         \
-    do {                                                                    \
-        if (d->fsys->error() != FMOD_OK) {                                  \
-            qWarning() << Q_FUNC_INFO << __LINE__ << d->fsys->errorString();                           \
-        }                                                                   \
-    } while (0)
+#include <QSettings>
 
 /**
  * How long before we actually go back.
@@ -32,42 +32,146 @@
  */
 #define BACK_CUTOFF 10000
 
-#define SPECTRUM_GENERATIONS 8
+/**
+ * How far ahead of playback the analyzer looks.
+ *
+ * Has to cover the longest shell flight, so that every burst can still land
+ * on the audio that triggered it.  In milliseconds.
+ */
+#define LAUNCH_LEAD quint32(SHELL_MAX_FLIGHT_TIME * 1000)
+
+/**
+ * Default time between capturing live input and analyzing it.
+ *
+ * In milliseconds, overridden by the capture/latency setting.
+ */
+#define CAPTURE_LATENCY 10
+
+/**
+ * How much recent onset strength the live beat estimate looks at.
+ *
+ * In milliseconds.
+ */
+#define BEAT_HISTORY 8000
+
+/**
+ * Frames between live beat estimates.
+ */
+#define BEAT_ESTIMATE_FRAMES 32
+
+/**
+ * How often the audio thread's state is picked up, in milliseconds.
+ */
+#define POLL_INTERVAL 10
+
+/**
+ * How often the state is picked up while nothing plays, in milliseconds.
+ *
+ * Only to notice playback starting.
+ */
+#define IDLE_POLL_INTERVAL 100
+
 
 QPointer<SoundEngine> soundEngine;
 
-struct SoundEngine::Private
+/**
+ * A launch waiting for its time.
+ */
+struct PendingLaunch
 {
-    QtFMOD::System* fsys;
-    QHash<QString, QSharedPointer<QtFMOD::Sound> > sounds;
+    quint32 at;         ///< track position to launch at, in milliseconds
+    qreal flightTime;   ///< planned flight time, in seconds
+};
 
-    QSharedPointer<QtFMOD::Channel> channel;
-    QSharedPointer<QtFMOD::Sound> sound;
+/**
+ * Opens the analysis cache of a track on a worker, since it maps a file, and
+ * hands it to SoundEngine::cacheOpened().
+ */
+class CacheOpener : public QRunnable
+{
+public:
+    CacheOpener (SoundEngine* engine, const QUrl& url, int serial) :
+        engine(engine),
+        url(url),
+        serial(serial)
+    {
+    }
+
+    void run ()
+    {
+        AnalysisCache* cache = new AnalysisCache(url);
+        if (!engine
+            || !QMetaObject::invokeMethod(engine, "cacheOpened",
+                                          Qt::QueuedConnection,
+                                          Q_ARG(AnalysisCache*, cache),
+                                          Q_ARG(int, serial))) {
+            delete cache;
+        }
+    }
+
+private:
+    QPointer<SoundEngine> engine;
+    QUrl url;
+    int serial;
+};
 
-    int spectrumLength;
-    FMOD_DSP_FFT_WINDOW spectrumWindowType;
-    QVector<float> spectrumNew[2];      ///< values before smoothing
-    QVector<float> spectrum[2];         ///< values after smoothing
+struct SoundEngine::Private
+{
+    AudioThread* audio;
+    quint32 analyzedFrame;              ///< last spectrumFrame analyzed
+    int timerId;                        ///< of the poll
+    int pollInterval;                   ///< of timerId, in milliseconds
+    PowerState powerState;
+    bool live;                          ///< playing unpaused, or capturing
 
     Playlist* playlist;
     int current;
-    bool channelConnected;
+
+    QScopedPointer<AnalysisSource> analysis;    ///< cache or lookahead
+    Lookahead* lookahead;               ///< analysis, if it is one
+    QUrl analysisUrl;                   ///< whose cache is being opened
+    int analysisSerial;                 ///< of the last startAnalysis()
+    quint32 analyzedUntil;              ///< track time analyzed so far
+    QList<PendingLaunch> launches;      ///< sorted by time
+
+    float renderLatency;                ///< as measured by the scene
+
+    FeatureGraph* analyzerFeatures;     ///< of the frames being analyzed
+    FeatureGraph* liveFeatures;         ///< of the frame being heard
+
+    QScopedPointer<AnalysisShare> share;    ///< for other processes
+    QVector<quint32> beatTimes;         ///< recent frames, for the beat
+    QVector<float> beatFlux;
+    int beatFrames;                     ///< since the last estimate
+    qreal beatPeriod;                   ///< in milliseconds, 0 if unknown
+    qreal beatOffset;                   ///< in milliseconds
+    bool beatFromCache;
 
     Private (SoundEngine* q) :
-        fsys(new QtFMOD::System(q)),
-        spectrumLength(256),
-        spectrumWindowType(FMOD_DSP_FFT_WINDOW_RECT),
+        audio(new AudioThread(q)),
+        analyzedFrame(0),
+        timerId(0),
+        pollInterval(IDLE_POLL_INTERVAL),
+        powerState(ActiveState),
+        live(false),
 
         playlist(new Playlist(q)),
         current(0),
-        channelConnected(false)
+        lookahead(NULL),
+        analysisSerial(0),
+        analyzedUntil(0),
+        renderLatency(0.0f),
+        analyzerFeatures(new FeatureGraph(q)),
+        liveFeatures(new FeatureGraph(q)),
+        beatFrames(0),
+        beatPeriod(0.0),
+        beatOffset(0.0),
+        beatFromCache(false)
     {
-        fsys->setObjectName("fsys");
-
-        spectrumNew[0].resize(spectrumLength);
-        spectrumNew[1].resize(spectrumLength);
-        spectrum[0].resize(spectrumLength);
-        spectrum[1].resize(spectrumLength);
+        if (QSettings().value("analysis/share", true).toBool()) {
+            share.reset(new AnalysisShare);
+        }
+        audio->setObjectName("audio");
 
         QMetaObject::connectSlotsByName(q);
     }
@@ -80,6 +184,12 @@ SoundEngine::SoundEngine (QObject* parent) :
     qDebug() << Q_FUNC_INFO;
     Q_ASSERT(!soundEngine);
     soundEngine = this;
+
+    connect(d->audio, SIGNAL(trackStarted(const QUrl&)),
+            SLOT(autoAdvance(const QUrl&)));
+    connect(d->audio, SIGNAL(soundEnded()), SLOT(playNext()));
+
+    qRegisterMetaType<AnalysisCache*>("AnalysisCache*");
 }
 
 SoundEngine::~SoundEngine ()
@@ -94,151 +204,409 @@ Playlist* SoundEngine::playlist () const
 void SoundEngine::initialize ()
 {
     qDebug() << Q_FUNC_INFO;
-#ifdef Q_OS_LINUX
-    d->fsys->setOutput(FMOD_OUTPUTTYPE_ALSA);
-#endif
 
-    fsysCheck();
+    d->audio->start();
 
-    // init sound system
-    d->fsys->init(32);
-    fsysCheck();
+    d->timerId = startTimer(d->pollInterval);
+}
 
-    d->fsys->set3DNumListeners(1);
-    d->fsys->set3DSettings(1.0f, 1.0f, 0.3f);
+const QVector<float>& SoundEngine::spectrum (int idx) const
+{
+    return d->audio->state().spectrum[idx];
+}
 
-    // sound effects
-    QSharedPointer<QtFMOD::Sound> sound (
-        d->fsys->createSound(":media/sfx/explosion0.oga", FMOD_3D)
-        );
-    fsysCheck();
-    d->sounds.insert("explosion", sound);
-    sound->set3DMinMaxDistance(150, 600);
+int SoundEngine::spectrumLength () const
+{
+    return SPECTRUM_LENGTH;
+}
 
-    startTimer(10);
+/**
+ * The smoothed spectrum summarized into SPECTRUM_BANDS log-spaced bands.
+ */
+const QVector<float>& SoundEngine::bands (int idx) const
+{
+    return d->audio->state().bands[idx];
 }
 
-QtFMOD::System* SoundEngine::soundSystem () const
+/**
+ * Counts spectrum updates, so consumers can tell when spectrum() changed.
+ */
+quint32 SoundEngine::spectrumFrame () const
 {
-    return d->fsys;
+    return d->audio->state().spectrumFrame;
 }
 
-QWeakPointer<QtFMOD::Sound> SoundEngine::sound (const QString& name) const
+/**
+ * The spectra of the last SPECTRUM_HISTORY spectrum updates.
+ *
+ * See AudioState::history.
+ */
+const QVector<float>& SoundEngine::spectrumHistory () const
+{
+    return d->audio->state().history;
+}
+
+/**
+ * Features of the frame being heard, for scripts that react to it.
+ */
+FeatureGraph* SoundEngine::features () const
 {
-    return d->sounds[name];
+    return d->liveFeatures;
 }
 
-QWeakPointer<QtFMOD::Sound> SoundEngine::stream () const
+/**
+ * Playback position, in milliseconds.
+ */
+quint32 SoundEngine::position () const
 {
-    return d->sound;
+    return d->audio->state().position;
 }
 
-QWeakPointer<QtFMOD::Channel> SoundEngine::streamChannel () const
+/**
+ * Length of the current stream, in milliseconds, 0xffffffff if unknown.
+ */
+quint32 SoundEngine::length () const
 {
-    return d->channel;
+    return d->audio->state().length;
 }
 
+float SoundEngine::volume () const
+{
+    return d->audio->state().volume;
+}
 
-const QVector<float>& SoundEngine::spectrum (int idx) const
+bool SoundEngine::isPaused () const
 {
-    return d->spectrum[idx];
+    return d->audio->state().paused;
 }
 
-int SoundEngine::spectrumLength () const
+/**
+ * How full the read-ahead of a network stream is, in percent.
+ */
+int SoundEngine::streamBuffer () const
+{
+    return d->audio->state().streamBuffer;
+}
+
+/**
+ * How long after position() the audio is heard, in milliseconds.
+ */
+float SoundEngine::outputLatency () const
+{
+    return d->audio->state().outputLatency;
+}
+
+/**
+ * How long after it is drawn a frame is seen, in milliseconds.
+ */
+float SoundEngine::renderLatency () const
+{
+    return d->renderLatency;
+}
+
+void SoundEngine::setRenderLatency (float ms)
+{
+    d->renderLatency = ms;
+}
+
+/**
+ * How much visuals have to be held back to line up with the audio.
+ *
+ * Negative if the screen lags the speakers.  In milliseconds.
+ */
+float SoundEngine::syncOffset () const
+{
+    return outputLatency() - d->renderLatency;
+}
+
+void SoundEngine::seek (quint32 ms)
+{
+    d->audio->seek(ms);
+}
+
+void SoundEngine::setVolume (float volume)
+{
+    d->audio->setVolume(volume);
+}
+
+void SoundEngine::setListener (const btVector3& position,
+                               const btVector3& velocity,
+                               const btVector3& forward,
+                               const btVector3& up)
+{
+    d->audio->setListener(position, velocity, forward, up);
+}
+
+/**
+ * Play a sound effect at @a position, in time with the frame it belongs to.
+ */
+void SoundEngine::playEffect (const QString& name, const btVector3& position)
 {
-    return d->spectrumLength;
+    d->audio->playEffect(name, position, qRound(-syncOffset()));
 }
 
+/**
+ * Launch script function.
+ *
+ * The callee's data holds the track time the analyzed audio belongs to,
+ * which is when the burst should happen.
+ */
 static
 QScriptValue launchFun (QScriptContext* ctx, QScriptEngine* eng)
 {
-    Q_UNUSED(ctx);
     Q_UNUSED(eng);
-    scene->launch();
+    soundEngine->scheduleLaunch(ctx->callee().data().toUInt32());
     return QScriptValue();
 }
 
-void SoundEngine::analyzeSound ()
+/**
+ * Queue a launch so that its shell bursts at @a burstTime.
+ *
+ * @param[in] burstTime track position, in milliseconds
+ */
+void SoundEngine::scheduleLaunch (quint32 burstTime)
 {
-    if (!d->channel || d->channel->paused()) {
-        return;
+    PendingLaunch launch;
+    launch.flightTime = Shell::randomFlightTime();
+
+    quint32 flight = launch.flightTime * 1000;
+    launch.at = burstTime > flight ? burstTime - flight : 0;
+
+    QList<PendingLaunch>::iterator it = d->launches.begin();
+    while (it != d->launches.end() && it->at <= launch.at) {
+        ++it;
     }
+    d->launches.insert(it, launch);
+}
 
-    // scripted analyzer
+/**
+ * Launch everything that is due at @a position.
+ *
+ * Held back or brought forward by syncOffset(), so the burst is seen when
+ * its audio is heard.
+ */
+void SoundEngine::dispatchLaunches (quint32 position)
+{
+    qint64 seen = qint64(position) - qRound(syncOffset());
+    while (!d->launches.isEmpty() && d->launches.first().at <= seen) {
+        scene->launch(d->launches.takeFirst().flightTime);
+    }
+}
+
+/**
+ * Evaluate the analyzer script against one spectrum.
+ *
+ * @param[in] spectrum both channels
+ * @param[in] time the track position @a spectrum belongs to
+ */
+void SoundEngine::runAnalyzer (const QVector<float>* spectrum, quint32 time)
+{
     QScriptEngine* scriptEngine = scene->scriptEngine();
     QScriptContext* ctx = scriptEngine->pushContext();
     QScriptValue ao = ctx->activationObject();
-    prepGlobalObject(ao);
-    ao.setProperty("launch", scriptEngine->newFunction(launchFun));
+    d->analyzerFeatures->beginHop(spectrum, time);
+    prepGlobalObject(scriptEngine, ao, d->analyzerFeatures);
+    QScriptValue launch = scriptEngine->newFunction(launchFun);
+    launch.setData(time);
+    ao.setProperty("launch", launch);
     scriptEngine->evaluate(scene->analyzerProgram());
     scriptEngine->popContext();
 }
 
-void SoundEngine::checkTags ()
+void SoundEngine::analyzeSound ()
 {
-    if (!d->sound) {
-        return;
+    quint32 position = d->audio->state().position;
+    quint32 target = position + LAUNCH_LEAD;
+
+    if (d->analysis) {
+        d->analysis->setPlaybackPosition(position);
     }
-    int nbUpdated;
-    QHash<QString, QtFMOD::Tag> tags (d->sound->tags(&nbUpdated));
-    if (nbUpdated > 0) {
-        if (tags.contains("TITLE")) {
-            QString title (tr("%0 / %1 - FyreWare"));
-            title = title.arg(tags["ARTIST"].value().toString());
-            title = title.arg(tags["TITLE"].value().toString());
-            //setWindowTitle(title);
-        }
-        qDebug();
-    }
-    QHashIterator<QString, QtFMOD::Tag> tagIter (tags);
-    while (tagIter.hasNext()) {
-        tagIter.next();
-        QtFMOD::Tag tag (tagIter.value());
-        if (tag.updated()) {
-            qDebug().nospace()
-                << qPrintable(tagIter.key()) << ": "
-                << qPrintable(tag.value().toString());
-            if (tag.name() == "APIC") {
-                //setWindowIcon(QPixmap::fromImage(tag.toImage()));
-            }
+
+    if (target < d->analyzedUntil || target > d->analyzedUntil + LAUNCH_LEAD) {
+        // playback jumped, anything queued belongs to the old position
+        d->launches.clear();
+        d->analyzedUntil = target;
+    }
+
+    if (d->analysis && d->analysis->horizon() >= target) {
+        QList<AnalysisFrame> frames (
+            d->analysis->frames(d->analyzedUntil, target));
+        foreach (const AnalysisFrame& frame, frames) {
+            runAnalyzer(frame.spectrum, frame.time);
         }
+    } else {
+        // no analysis this far ahead yet, so react to what is heard now
+        runAnalyzer(d->audio->state().spectrum, position);
     }
+    d->analyzedUntil = target;
+
+    dispatchLaunches(position);
 }
 
+/**
+ * Pick up what the audio thread published, and run the analyzer once per
+ * analyzed block.
+ */
 void SoundEngine::timerEvent (QTimerEvent* evt)
 {
     Q_UNUSED(evt);
 
-    Q_ASSERT(d->fsys);
+    if (!d->audio->update()) {
+        return;
+    }
+    postTelemetry();
+
+    const AudioState& state (d->audio->state());
+    bool live = (state.playing && !state.paused) || state.capturing;
+    if (live != d->live) {
+        d->live = live;
+        updatePollInterval();
+    }
+
+    // paused or stopped, whether the window is idle, hidden or neither
+    if (!d->live || state.spectrumFrame == d->analyzedFrame) {
+        return;
+    }
+    d->analyzedFrame = state.spectrumFrame;
 
-    d->fsys->update();
+    d->liveFeatures->beginHop(state.spectrum, state.position);
+    shareFrame();
 
-    analyzeSound();
-    checkTags();
+    // other processes may still want the frames, but nobody sees launches
+    if (d->powerState != HiddenState) {
+        analyzeSound();
+    }
+}
 
-    // spectrum
-    if (isPlaying()) {
-        d->channel->spectrum(d->spectrumNew[0], 0, d->spectrumWindowType);
-        d->channel->spectrum(d->spectrumNew[1], 1, d->spectrumWindowType);
-
-        for (int i = 0; i < d->spectrumLength; i++) {
-            expMovAvg(d->spectrum[0][i],
-                      d->spectrumNew[0][i],
-                      d->spectrumNew[0][i] > d->spectrum[0][i]
-                      ? 1.5 : SPECTRUM_GENERATIONS);
-            expMovAvg(d->spectrum[1][i],
-                      d->spectrumNew[1][i],
-                      d->spectrumNew[1][i] > d->spectrum[1][i]
-                      ? 1.5 : SPECTRUM_GENERATIONS);
+/**
+ * Publish the frame being heard to other processes, with its features and
+ * beat phase.
+ *
+ * The beat comes from the analysis cache when the track has one, and is
+ * otherwise estimated from the last BEAT_HISTORY of onset strength.
+ */
+void SoundEngine::shareFrame ()
+{
+    if (!d->share || !d->share->isOpen()) {
+        return;
+    }
+
+    const AudioState& state (d->audio->state());
+
+    AnalysisFrame frame;
+    frame.time = state.position;
+    frame.spectrum[0] = state.spectrum[0];
+    frame.spectrum[1] = state.spectrum[1];
+    frame.loudness = d->liveFeatures->scalar(FeatureGraph::Loudness);
+    frame.flux = d->liveFeatures->scalar(FeatureGraph::Flux);
+    frame.onset = d->liveFeatures->scalar(FeatureGraph::Onset) != 0.0f;
+
+    if (!d->beatFromCache) {
+        d->beatTimes.append(frame.time);
+        d->beatFlux.append(frame.flux);
+        int old = 0;
+        while (old < d->beatTimes.size()
+               && d->beatTimes[old] + BEAT_HISTORY < frame.time) {
+            old++;
+        }
+        d->beatTimes.remove(0, old);
+        d->beatFlux.remove(0, old);
+
+        if (++d->beatFrames >= BEAT_ESTIMATE_FRAMES) {
+            d->beatFrames = 0;
+            if (!estimateBeat(d->beatTimes, d->beatFlux,
+                              &d->beatPeriod, &d->beatOffset)) {
+                d->beatPeriod = 0.0;
+            }
+        }
+    }
+
+    qreal phase = 0.0;
+    if (d->beatPeriod > 0.0) {
+        phase = fmod(frame.time - d->beatOffset, d->beatPeriod);
+        if (phase < 0.0) {
+            phase += d->beatPeriod;
         }
+        phase /= d->beatPeriod;
+    }
+
+    d->share->write(frame, state.bands, d->beatPeriod, phase);
+}
+
+/**
+ * See updatePollInterval().
+ *
+ * While hidden the analyzer script is not run, and launches it queued are
+ * dropped rather than fired all at once on return.
+ */
+void SoundEngine::setPowerState (PowerState state)
+{
+    d->powerState = state;
+    if (state == HiddenState) {
+        d->launches.clear();
+        d->analyzedUntil = 0;
+    }
+    updatePollInterval();
+}
+
+/**
+ * Poll slower while nothing plays, or while idle.
+ *
+ * Driven by what is heard rather than by the power state alone, which says
+ * hidden for a minimized window whether it plays or not.
+ */
+void SoundEngine::updatePollInterval ()
+{
+    int interval = d->live && d->powerState != IdleState
+        ? POLL_INTERVAL : IDLE_POLL_INTERVAL;
+    if (interval == d->pollInterval) {
+        return;
+    }
+    d->pollInterval = interval;
+    if (d->timerId) {
+        killTimer(d->timerId);
+        d->timerId = startTimer(d->pollInterval);
+    }
+}
+
+/**
+ * Post what the player shows, the telemetry drops what did not change.
+ */
+void SoundEngine::postTelemetry ()
+{
+    if (!telemetry) {
+        return;
     }
+
+    const AudioState& state (d->audio->state());
+    telemetry->post("player/playing", state.playing);
+    telemetry->post("player/paused", state.paused);
+    telemetry->post("player/position", state.position);
+    telemetry->post("player/length", state.length);
+    telemetry->post("player/volume", state.volume);
+    telemetry->post("player/streamBuffer", state.streamBuffer);
+    telemetry->post("player/title", state.title);
+    telemetry->post("player/artist", state.artist);
+}
+
+/**
+ * Forget the beat of the previous track.
+ */
+void SoundEngine::resetBeat ()
+{
+    d->beatTimes.clear();
+    d->beatFlux.clear();
+    d->beatFrames = 0;
+    d->beatPeriod = 0.0;
+    d->beatOffset = 0.0;
+    d->beatFromCache = false;
 }
 
 void SoundEngine::prev ()
 {
-    if (isPlaying() && d->channel->position(FMOD_TIMEUNIT_MS) > BACK_CUTOFF) {
+    if (isPlaying() && position() > BACK_CUTOFF) {
         // back up
-        d->channel->setPosition(0, FMOD_TIMEUNIT_MS);
+        seek(0);
         return;
     }
 
@@ -263,8 +631,8 @@ void SoundEngine::next ()
  */
 void SoundEngine::play ()
 {
-    if (d->channel) {
-        d->channel->setPaused(!d->channel->paused());
+    if (d->audio->state().open) {
+        d->audio->togglePause();
     } else {
         playSong();
     }
@@ -294,13 +662,15 @@ void SoundEngine::advance (int offset)
 
 bool SoundEngine::isPlaying () const
 {
-    if (!d->channel) {
-        return false;
-    }
-    Q_ASSERT(d->channel);
-    return d->channel->isPlaying();
+    return d->audio->state().playing;
 }
 
+/**
+ * Start playing @a url, or the current playlist entry.
+ *
+ * Only queues the request, the audio thread opens the stream without
+ * blocking.
+ */
 void SoundEngine::playSong (QUrl url)
 {
     if (!url.isValid()) {
@@ -308,25 +678,137 @@ void SoundEngine::playSong (QUrl url)
     }
     showit(url);
 
-    d->sound = d->fsys->createStream(url.toString());
-    fsysCheck();
-    Q_ASSERT(d->sound);
+    d->audio->play(url);
+
+    startAnalysis(url);
+    preloadNext();
+}
+
+/**
+ * Analyze live input instead of the playlist.
+ *
+ * Playing a song goes back to the playlist.
+ *
+ * @param[in] source empty for the default recording driver, or the path of
+ * a WAV file to stand in for one
+ */
+void SoundEngine::capture (const QString& source)
+{
+    float latency = QSettings().value("capture/latency",
+                                      CAPTURE_LATENCY).toFloat();
+    d->audio->capture(source, latency);
+
+    // nothing to look ahead into
+    d->launches.clear();
+    d->analyzedUntil = 0;
+    dropAnalysis();
+    resetBeat();
+}
+
+bool SoundEngine::isCapturing () const
+{
+    return d->audio->state().capturing;
+}
+
+/**
+ * Set up analysis of a new track, from disk if it was played before.
+ *
+ * The cache is opened on a worker, cacheOpened() carries on.  Until then the
+ * analyzer reacts to what is heard.
+ */
+void SoundEngine::startAnalysis (const QUrl& url)
+{
+    d->launches.clear();
+    d->analyzedUntil = 0;
+    dropAnalysis();
+    resetBeat();
+
+    d->analysisUrl = url;
+    threadManager->start(new CacheOpener(this, url, d->analysisSerial),
+                         WorkerRole);
+}
+
+/**
+ * Let go of the current analysis, and of any cache still being opened.
+ *
+ * A lookahead may be in the middle of decoding a block, so it is only told
+ * to stop, and deletes itself once it has.  Being our child, the last ones
+ * are waited for when the engine goes away.
+ */
+void SoundEngine::dropAnalysis ()
+{
+    d->analysisSerial++;
+
+    if (!d->lookahead) {
+        d->analysis.reset();
+        return;
+    }
+
+    Lookahead* lookahead = d->lookahead;
+    d->analysis.take();
+    d->lookahead = NULL;
+
+    connect(lookahead, SIGNAL(finished()), lookahead, SLOT(deleteLater()));
+    lookahead->stop();
+    if (lookahead->isFinished()) {
+        delete lookahead;
+    }
+}
 
-    d->fsys->playSound(FMOD_CHANNEL_REUSE, d->sound, false, d->channel);
-    fsysCheck();
-    Q_ASSERT(d->channel);
+/**
+ * The cache for the startAnalysis() numbered @a serial was opened.
+ *
+ * Decodes ahead when there is none.
+ */
+void SoundEngine::cacheOpened (AnalysisCache* cache, int serial)
+{
+    QScopedPointer<AnalysisCache> opened (cache);
+    if (serial != d->analysisSerial) {
+        return;
+    }
 
-    showit(d->channel->isPlaying());
+    if (opened->isValid()) {
+        d->beatPeriod = opened->beatPeriod();
+        d->beatOffset = opened->beatOffset();
+        d->beatFromCache = d->beatPeriod > 0.0;
+        d->analysis.reset(opened.take());
+    } else if (d->analysisUrl.scheme() == "file"
+               || d->analysisUrl.scheme().isEmpty()) {
+        // network streams can not be decoded ahead
+        d->lookahead = new Lookahead(d->analysisUrl, this);
+        d->analysis.reset(d->lookahead);
+        d->lookahead->start();
+    }
+}
 
-    if (!d->channelConnected) {
-        d->channelConnected = true;
-        connect(d->channel.data(), SIGNAL(soundEnded()), SLOT(autoAdvance()));
+/**
+ * Have the audio thread open the entry after the current one, so it can
+ * follow without a gap.
+ */
+void SoundEngine::preloadNext ()
+{
+    if (d->playlist->isEmpty()) {
+        return;
     }
+    d->audio->preload(d->playlist->at((d->current + 1) % d->playlist->size()));
+}
+
+/**
+ * The audio thread moved on to the preloaded track by itself.
+ */
+void SoundEngine::autoAdvance (const QUrl& url)
+{
+    showit(url);
+    advance(1);
+    startAnalysis(url);
+    preloadNext();
 }
 
-void SoundEngine::autoAdvance ()
+/**
+ * The track ended with nothing ready to take over, so play the next one.
+ */
+void SoundEngine::playNext ()
 {
-    //showit(d->channel->isPlaying());
-    //advance(1);
-    //playSong();
+    advance(1);
+    playSong();
 }
@@ -7,19 +7,15 @@
 #pragma once
 
 #include <QObject>
-
 #include <QPointer>
-#include <QWeakPointer>
 #include <QUrl>
 
-namespace QtFMOD
-{
-class System;
-class Sound;
-class Channel;
-}
+#include "PowerManager.h"
 
 class Playlist;
+class AnalysisCache;
+class FeatureGraph;
+class btVector3;
 
 class SoundEngine : public QObject
 {
@@ -33,33 +29,65 @@ public:
 
     const QVector<float>& spectrum (int idx) const;
     int spectrumLength () const;
+    const QVector<float>& bands (int idx) const;
+    quint32 spectrumFrame () const;
+    const QVector<float>& spectrumHistory () const;
+    FeatureGraph* features () const;
+
+    quint32 position () const;
+    quint32 length () const;
+    float volume () const;
+    bool isPaused () const;
+    int streamBuffer () const;
 
-    QtFMOD::System* soundSystem () const;
+    float outputLatency () const;
+    float renderLatency () const;
+    void setRenderLatency (float ms);
+    float syncOffset () const;
 
-    QWeakPointer<QtFMOD::Sound> sound (const QString& name) const;
+    void seek (quint32 ms);
+    void setVolume (float volume);
 
-    QWeakPointer<QtFMOD::Sound> stream () const;
-    QWeakPointer<QtFMOD::Channel> streamChannel () const;
+    void setListener (const btVector3& position, const btVector3& velocity,
+                      const btVector3& forward, const btVector3& up);
+    void playEffect (const QString& name, const btVector3& position);
 
     void initialize ();
 
     void playSong (QUrl url = QUrl());
+    void capture (const QString& source = QString());
+    bool isCapturing () const;
 
     bool isPlaying () const;
 
+    void scheduleLaunch (quint32 burstTime);
+
 public slots:
     void prev ();
     void play ();
     void next ();
 
+    void setPowerState (PowerState state);
+
 protected:
     void analyzeSound ();
-    void checkTags ();
+    void runAnalyzer (const QVector<float>* spectrum, quint32 time);
+    void dispatchLaunches (quint32 position);
+    void shareFrame ();
+    void postTelemetry ();
+    void updatePollInterval ();
+    void resetBeat ();
+
+    void startAnalysis (const QUrl& url);
+    void dropAnalysis ();
+    void preloadNext ();
 
     void advance (int offset);
 
 private slots:
-    void autoAdvance ();
+    void autoAdvance (const QUrl& url);
+    void playNext ();
+    void cacheOpened (AnalysisCache* cache, int serial);
 
 private:
     void timerEvent (QTimerEvent* evt);
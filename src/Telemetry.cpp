@@ -0,0 +1,184 @@
+/**
+ * @file Telemetry.cpp
+ * @brief Telemetry implementation
+ */
+
+#include "Telemetry.moc"
+
+#include <QTimer>
+#include <QSignalMapper>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QDebug>
+
+QPointer<Telemetry> telemetry;
+
+/**
+ * @class Telemetry
+ *
+ * @brief hands changing values from producers to the UI at its own pace
+ *
+ * Producers post() values under keys like "render/fps", from any thread and
+ * as often as they like.  A value equal to the one posted before is not a
+ * change.
+ *
+ * Consumers subscribe() with an interval and the keys they care about.  At
+ * most once per interval, and only if any of those keys changed since the
+ * last time, the consumer's method is invoked with a QVariantHash of the
+ * changed keys and their newest values.  Whatever changed several times in
+ * between arrives once.  The first delivery carries all values posted so
+ * far.
+ */
+
+namespace
+{
+
+struct Entry
+{
+    QVariant value;
+    quint64 version;            ///< of the last change
+};
+
+struct Subscription
+{
+    QPointer<QObject> receiver;
+    QByteArray method;
+    QStringList keys;           ///< all if empty
+    quint64 version;            ///< delivered up to
+    QTimer* timer;
+};
+
+} // namespace
+
+struct Telemetry::Private
+{
+    mutable QMutex mutex;
+    QHash<QString, Entry> entries;
+    quint64 version;            ///< of the last change to any entry
+
+    QHash<int, Subscription> subscriptions;
+    int nextId;
+    QSignalMapper* timers;
+
+    Private (Telemetry* q) :
+        version(0),
+        nextId(0),
+        timers(new QSignalMapper(q))
+    {
+    }
+};
+
+Telemetry::Telemetry (QObject* parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+    Q_ASSERT(!telemetry);
+    telemetry = this;
+
+    connect(d->timers, SIGNAL(mapped(int)), SLOT(deliver(int)));
+}
+
+Telemetry::~Telemetry ()
+{
+}
+
+/**
+ * Set @a key to @a value.
+ *
+ * @warning any thread
+ */
+void Telemetry::post (const QString& key, const QVariant& value)
+{
+    QMutexLocker locker (&d->mutex);
+    QHash<QString, Entry>::iterator it = d->entries.find(key);
+    if (it == d->entries.end()) {
+        Entry entry = { value, ++d->version };
+        d->entries.insert(key, entry);
+    } else if (it->value != value) {
+        it->value = value;
+        it->version = ++d->version;
+    }
+}
+
+/**
+ * The last value posted for @a key.
+ *
+ * @warning any thread
+ */
+QVariant Telemetry::value (const QString& key) const
+{
+    QMutexLocker locker (&d->mutex);
+    return d->entries.value(key).value;
+}
+
+/**
+ * Invoke @a method of @a receiver with the changes to @a keys, at most
+ * every @a interval milliseconds.
+ *
+ * @a method is a slot name, taking a const QVariantHash&.  The subscription
+ * ends with the receiver.
+ *
+ * @warning gui thread only
+ */
+void Telemetry::subscribe (QObject* receiver, const char* method,
+                           int interval, const QStringList& keys)
+{
+    int id = d->nextId++;
+
+    Subscription sub;
+    sub.receiver = receiver;
+    sub.method = method;
+    sub.keys = keys;
+    sub.version = 0;
+    sub.timer = new QTimer(this);
+    d->subscriptions.insert(id, sub);
+
+    d->timers->setMapping(sub.timer, id);
+    connect(sub.timer, SIGNAL(timeout()), d->timers, SLOT(map()));
+    sub.timer->start(interval);
+
+    deliver(id);
+}
+
+void Telemetry::deliver (int id)
+{
+    QHash<int, Subscription>::iterator sub = d->subscriptions.find(id);
+    if (sub == d->subscriptions.end()) {
+        return;
+    }
+    if (!sub->receiver) {
+        delete sub->timer;
+        d->subscriptions.erase(sub);
+        return;
+    }
+
+    QVariantHash changes;
+    {
+        QMutexLocker locker (&d->mutex);
+        if (sub->version == d->version) {
+            return;
+        }
+        QHash<QString, Entry>::const_iterator it;
+        for (it = d->entries.constBegin(); it != d->entries.constEnd(); ++it) {
+            if (it->version > sub->version
+                && (sub->keys.isEmpty() || sub->keys.contains(it.key()))) {
+                changes.insert(it.key(), it->value);
+            }
+        }
+        sub->version = d->version;
+    }
+
+    if (changes.isEmpty()) {
+        return;
+    }
+
+    // the receiver may subscribe in turn, which invalidates sub
+    QObject* receiver = sub->receiver;
+    QByteArray method (sub->method);
+    if (!QMetaObject::invokeMethod(receiver, method.constData(),
+                                   Q_ARG(QVariantHash, changes))) {
+        qWarning() << Q_FUNC_INFO << "cannot invoke" << method
+                   << "of" << receiver;
+    }
+}
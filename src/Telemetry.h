@@ -0,0 +1,35 @@
+/**
+ * @file Telemetry.h
+ * @brief Telemetry definition
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QVariant>
+#include <QStringList>
+
+class Telemetry : public QObject
+{
+    Q_OBJECT
+
+public:
+    Telemetry (QObject* parent = NULL);
+    virtual ~Telemetry ();
+
+    void post (const QString& key, const QVariant& value);
+    QVariant value (const QString& key) const;
+
+    void subscribe (QObject* receiver, const char* method, int interval,
+                    const QStringList& keys = QStringList());
+
+private slots:
+    void deliver (int id);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
+
+extern QPointer<Telemetry> telemetry;
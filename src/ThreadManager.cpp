@@ -0,0 +1,424 @@
+/**
+ * @file ThreadManager.cpp
+ * @brief ThreadManager implementation
+ */
+
+#include "ThreadManager.moc"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * SCHED_FIFO priority of the audio thread, when permitted.
+ *
+ * Low, so kernel interrupt threads still come first.
+ */
+#define AUDIO_REALTIME_PRIORITY 10
+
+/**
+ * Nice value of the audio thread, when realtime is not permitted.
+ */
+#define AUDIO_NICE -10
+
+/**
+ * Nice value of the render thread.
+ */
+#define RENDER_NICE -5
+
+/**
+ * Nice value of the simulation thread.
+ */
+#define SIMULATION_NICE -5
+
+/*
+ * ioprio_set(2) has no glibc wrapper, nor constants.
+ */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+QPointer<ThreadManager> threadManager;
+
+/**
+ * @class ThreadManager
+ *
+ * @brief schedules every thread according to its role
+ *
+ * Threads call enter() when they start, which names them and sets their
+ * priority, I/O priority and CPU affinity.  Raising a priority usually takes
+ * privileges; when it is not permitted the thread keeps running with what
+ * it has.
+ *
+ * Pooled work is handed to start() instead, which runs it in the pool of its
+ * role.  Scanner work gets its own pool, so its idle threads never pick up
+ * anything else.
+ *
+ * The CPUs of a role can be set with the threads/<role>/cpus setting, e.g.
+ * threads/audio/cpus=3.  Roles without one may run anywhere.
+ *
+ * The CPU time of every thread that entered a role is kept, see usage().
+ */
+
+namespace
+{
+
+/**
+ * The thread a record belongs to, as seen by the ThreadManager.
+ */
+struct ThreadRecord
+{
+    QString name;
+    ThreadRole role;
+#ifdef Q_OS_LINUX
+    clockid_t clock;
+#endif
+
+    ThreadRecord (ThreadRole role, const QString& name);
+    ~ThreadRecord ();
+
+    qreal cpuMs () const;
+};
+
+QMutex registryMutex;
+QList<ThreadRecord*> records;           ///< of running threads
+qreal retiredMs[ThreadRoleCount];       ///< of finished threads, per role
+
+QThreadStorage<ThreadRecord*> currentRecord;
+
+/**
+ * @warning on the thread the record is for
+ */
+ThreadRecord::ThreadRecord (ThreadRole role, const QString& name) :
+    name(name),
+    role(role)
+{
+#ifdef Q_OS_LINUX
+    if (pthread_getcpuclockid(pthread_self(), &clock) != 0) {
+        clock = CLOCK_THREAD_CPUTIME_ID;
+    }
+#endif
+    QMutexLocker locker (&registryMutex);
+    records.append(this);
+}
+
+/**
+ * Deleted by QThreadStorage when the thread finishes, while the thread's
+ * clock is still valid.
+ */
+ThreadRecord::~ThreadRecord ()
+{
+    QMutexLocker locker (&registryMutex);
+    records.removeOne(this);
+    retiredMs[role] += cpuMs();
+}
+
+qreal ThreadRecord::cpuMs () const
+{
+#ifdef Q_OS_LINUX
+    timespec ts;
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0.0;
+    }
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    return 0.0;
+#endif
+}
+
+/**
+ * Runs a job after its thread entered the job's role.
+ */
+class RoleJob : public QRunnable
+{
+public:
+    RoleJob (QRunnable* job, ThreadRole role) :
+        job(job),
+        role(role)
+    {
+    }
+
+    void run ()
+    {
+        if (threadManager) {
+            threadManager->enter(role);
+        }
+        job->run();
+        if (job->autoDelete()) {
+            delete job;
+        }
+    }
+
+private:
+    QRunnable* job;
+    ThreadRole role;
+};
+
+} // namespace
+
+struct ThreadManager::Private
+{
+    QThreadPool* scannerPool;
+#ifdef Q_OS_LINUX
+    cpu_set_t allCpus;          ///< the process may run on
+#endif
+
+    Private (ThreadManager* q) :
+        scannerPool(new QThreadPool(q))
+    {
+#ifdef Q_OS_LINUX
+        CPU_ZERO(&allCpus);
+        if (sched_getaffinity(0, sizeof(allCpus), &allCpus) != 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                CPU_SET(i, &allCpus);
+            }
+        }
+#endif
+    }
+
+    void apply (ThreadRole role, const QString& name);
+};
+
+ThreadManager::ThreadManager (QObject* parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+    Q_ASSERT(!threadManager);
+    threadManager = this;
+}
+
+ThreadManager::~ThreadManager ()
+{
+    // the main thread's storage may outlive the registry
+    if (currentRecord.hasLocalData()) {
+        currentRecord.setLocalData(NULL);
+    }
+}
+
+/**
+ * Schedule the current thread for @a role.
+ *
+ * Cheap when the thread is in @a role already, so pooled jobs can call it
+ * every time.
+ *
+ * @param[in] name shown by top and friends, the role name if empty
+ */
+void ThreadManager::enter (ThreadRole role, const QString& name)
+{
+    QString threadName (name.isEmpty() ? roleName(role) : name);
+
+    ThreadRecord* record = currentRecord.hasLocalData()
+        ? currentRecord.localData() : NULL;
+    if (record) {
+        if (record->role == role && record->name == threadName) {
+            return;
+        }
+        QMutexLocker locker (&registryMutex);
+        record->role = role;
+        record->name = threadName;
+    } else {
+        currentRecord.setLocalData(new ThreadRecord(role, threadName));
+    }
+
+    d->apply(role, threadName);
+}
+
+/**
+ * Run @a job in the pool of @a role.
+ *
+ * Audio, render and simulation have dedicated threads, their jobs go to the
+ * worker pool but keep their role.
+ */
+void ThreadManager::start (QRunnable* job, ThreadRole role, int priority)
+{
+    pool(role)->start(new RoleJob(job, role), priority);
+}
+
+QThreadPool* ThreadManager::pool (ThreadRole role) const
+{
+    if (role == ScannerRole) {
+        return d->scannerPool;
+    }
+    return QThreadPool::globalInstance();
+}
+
+/**
+ * CPU time used by each running thread, and by the finished threads of
+ * each role.
+ */
+QList<ThreadUsage> ThreadManager::usage () const
+{
+    QList<ThreadUsage> list;
+    QMutexLocker locker (&registryMutex);
+    foreach (ThreadRecord* record, records) {
+        ThreadUsage u = { record->name, record->role, record->cpuMs(), true };
+        list.append(u);
+    }
+    for (int r = 0; r < ThreadRoleCount; r++) {
+        if (retiredMs[r] > 0.0) {
+            ThreadUsage u = {
+                roleName(ThreadRole(r)), ThreadRole(r), retiredMs[r], false
+            };
+            list.append(u);
+        }
+    }
+    return list;
+}
+
+/**
+ * Log usage().
+ */
+void ThreadManager::report () const
+{
+    foreach (const ThreadUsage& u, usage()) {
+        qDebug() << Q_FUNC_INFO << u.name << roleName(u.role)
+                 << (u.running ? "running" : "finished")
+                 << u.cpuMs << "ms cpu";
+    }
+}
+
+/**
+ * The role the calling thread entered, or ThreadRoleCount if none.
+ */
+ThreadRole ThreadManager::currentRole ()
+{
+    return currentRecord.hasLocalData() && currentRecord.localData()
+        ? currentRecord.localData()->role : ThreadRoleCount;
+}
+
+QString ThreadManager::roleName (ThreadRole role)
+{
+    switch (role) {
+    case AudioRole:
+        return "audio";
+    case RenderRole:
+        return "render";
+    case SimulationRole:
+        return "simulation";
+    case WorkerRole:
+        return "worker";
+    case ScannerRole:
+        return "scanner";
+    case ThreadRoleCount:
+        break;
+    }
+    return QString();
+}
+
+/**
+ * Name and schedule the current thread.
+ *
+ * Everything is set explicitly, since threads inherit all of it from
+ * whichever thread created them.
+ */
+void ThreadManager::Private::apply (ThreadRole role, const QString& name)
+{
+    QSettings settings;
+
+#ifdef Q_OS_LINUX
+    pid_t tid = syscall(SYS_gettid);
+
+    // renaming the main thread would rename the process
+    if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+        prctl(PR_SET_NAME, name.toLocal8Bit().constData());
+    }
+
+    // cpu
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    bool realtime = false;
+    if (role == AudioRole) {
+        param.sched_priority = settings.value(
+            "threads/audio/realtimePriority", AUDIO_REALTIME_PRIORITY).toInt();
+        realtime = param.sched_priority > 0
+            && pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+        if (!realtime) {
+            qDebug() << Q_FUNC_INFO << name << "realtime not permitted";
+        }
+    }
+    if (!realtime) {
+        param.sched_priority = 0;
+        int policy = SCHED_OTHER;
+#ifdef SCHED_IDLE
+        if (role == ScannerRole) {
+            policy = SCHED_IDLE;
+        }
+#endif
+        pthread_setschedparam(pthread_self(), policy, &param);
+
+        int nice = 0;
+        if (role == AudioRole) {
+            nice = AUDIO_NICE;
+        } else if (role == RenderRole) {
+            nice = RENDER_NICE;
+        } else if (role == SimulationRole) {
+            nice = SIMULATION_NICE;
+        } else if (role == ScannerRole) {
+            nice = 19;
+        }
+        if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+            qDebug() << Q_FUNC_INFO << name << "nice" << nice
+                     << "not permitted";
+        }
+    }
+
+    // disk
+    int ioprio = 0;
+    if (role == ScannerRole) {
+        ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    }
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio);
+
+    // affinity
+    QStringList cpuList (
+        settings.value(QString("threads/%0/cpus").arg(roleName(role)))
+        .toStringList());
+    cpu_set_t cpus;
+    if (cpuList.isEmpty()) {
+        cpus = allCpus;
+    } else {
+        CPU_ZERO(&cpus);
+        foreach (const QString& cpu, cpuList) {
+            bool ok = false;
+            int i = cpu.trimmed().toInt(&ok);
+            if (ok && i >= 0 && i < CPU_SETSIZE) {
+                CPU_SET(i, &cpus);
+            }
+        }
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        qWarning() << Q_FUNC_INFO << name << "could not be pinned to"
+                   << cpuList;
+    }
+#else
+    Q_UNUSED(name);
+    Q_UNUSED(settings);
+
+    static const QThread::Priority priorities[ThreadRoleCount] = {
+        QThread::TimeCriticalPriority,
+        QThread::HighPriority,
+        QThread::HighPriority,
+        QThread::NormalPriority,
+        QThread::IdlePriority
+    };
+    QThread::currentThread()->setPriority(priorities[role]);
+#endif
+}
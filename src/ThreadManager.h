@@ -0,0 +1,63 @@
+/**
+ * @file ThreadManager.h
+ * @brief ThreadManager definition
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QList>
+
+class QRunnable;
+class QThreadPool;
+
+/**
+ * What a thread is for, which decides how it is scheduled.
+ */
+enum ThreadRole
+{
+    AudioRole,      ///< realtime when permitted, else the highest priority
+    RenderRole,     ///< above normal
+    SimulationRole, ///< above normal
+    WorkerRole,     ///< normal, e.g. scripts, lookahead and image loading
+    ScannerRole,    ///< idle, for both cpu and disk
+    ThreadRoleCount
+};
+
+/**
+ * CPU time one thread, or all finished threads of a role, used so far.
+ */
+struct ThreadUsage
+{
+    QString name;
+    ThreadRole role;
+    qreal cpuMs;
+    bool running;
+};
+
+class ThreadManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    ThreadManager (QObject* parent = NULL);
+    virtual ~ThreadManager ();
+
+    void enter (ThreadRole role, const QString& name = QString());
+    void start (QRunnable* job, ThreadRole role, int priority = 0);
+    QThreadPool* pool (ThreadRole role) const;
+
+    QList<ThreadUsage> usage () const;
+    void report () const;
+
+    static ThreadRole currentRole ();
+    static QString roleName (ThreadRole role);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
+
+extern QPointer<ThreadManager> threadManager;
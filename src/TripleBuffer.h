@@ -0,0 +1,93 @@
+
+/**
+ * @file TripleBuffer.h
+ * @brief TripleBuffer definition
+ */
+
+#pragma once
+
+#include <QAtomicInt>
+
+/**
+ * Lock-free hand-off of the newest value from one writer thread to one
+ * reader thread.
+ *
+ * The writer fills back() and calls publish(); the reader calls update()
+ * and then reads front().  Neither side ever waits, and the reader always
+ * gets the most recent complete value.  Values published in between are
+ * dropped.
+ */
+template<typename T>
+class TripleBuffer
+{
+private:
+    enum
+    {
+        IndexMask = 0x3,
+        Dirty = 0x4
+    };
+
+    T buffers[3];
+    int backIndex;          ///< owned by the writer
+    int frontIndex;         ///< owned by the reader
+    QAtomicInt middle;      ///< index of the spare buffer, plus Dirty
+
+public:
+    inline TripleBuffer () :
+        backIndex(0),
+        frontIndex(1),
+        middle(2)
+    {
+    }
+
+    /**
+     * The buffer being written.
+     *
+     * @warning writer thread only
+     */
+    inline
+    T& back ()
+    {
+        return buffers[backIndex];
+    }
+
+    /**
+     * Make back() visible to the reader and start on another buffer.
+     *
+     * @warning writer thread only
+     */
+    inline
+    void publish ()
+    {
+        int old = middle.fetchAndStoreOrdered(backIndex | Dirty);
+        backIndex = old & IndexMask;
+    }
+
+    /**
+     * Switch front() to the newest published buffer.
+     *
+     * @warning reader thread only
+     * @return false if nothing was published since the last call
+     */
+    inline
+    bool update ()
+    {
+        if (!(int(middle) & Dirty)) {
+            return false;
+        }
+        int old = middle.fetchAndStoreOrdered(frontIndex);
+        frontIndex = old & IndexMask;
+        return true;
+    }
+
+    /**
+     * The newest value as of the last update().
+     *
+     * @warning reader thread only
+     */
+    inline
+    const T& front () const
+    {
+        return buffers[frontIndex];
+    }
+};
@@ -0,0 +1,310 @@
+/**
+ * @file VoicePool.cpp
+ * @brief VoicePool implementation
+ */
+
+#include "VoicePool.h"
+
+#include "defs.h"
+
+#include <QtFMOD/System.h>
+#include <QtFMOD/Channel.h>
+#include <QtFMOD/Sound.h>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QDebug>
+
+#include <LinearMath/btVector3.h>
+
+/**
+ * Voices tracked at once, real and virtual.
+ *
+ * Past this, a new voice only gets in by replacing a less audible one.
+ */
+#define MAX_VOICES 64
+
+/**
+ * @name pitch
+ *
+ * Range each voice's playback rate is randomized over.
+ */
+//@{
+#define MIN_PITCH 0.85
+#define MAX_PITCH 1.15
+//@}
+
+/**
+ * @class VoicePool
+ *
+ * @brief plays one kind of sound effect on a fixed set of channels
+ *
+ * Every play() becomes a voice.  The most audible voices, by distance to
+ * the listener and by how far they are through their sample, are real and
+ * hold one of the pool's channels.  The rest are virtual: they are only
+ * timed, and pick up at the right offset if they become audible again.
+ * Voices out of range are dropped.  The cost stays the same however many
+ * voices are asked for.
+ *
+ * The samples are every resource matching ":media/sfx/<name>*.oga".
+ *
+ * @warning audio thread only
+ */
+
+namespace
+{
+
+struct Variant
+{
+    QSharedPointer<QtFMOD::Sound> sound;
+    quint32 length;             ///< in milliseconds
+};
+
+struct Voice
+{
+    int variant;
+    float pitch;
+    btVector3 position;
+    qint64 start;               ///< on the pool's clock
+    quint32 length;             ///< in milliseconds, at pitch
+    float audibility;
+    int slot;                   ///< -1 if virtual
+};
+
+bool moreAudible (const Voice& a, const Voice& b)
+{
+    return a.audibility > b.audibility;
+}
+
+} // namespace
+
+struct VoicePool::Private
+{
+    QtFMOD::System* fsys;
+    QVector<Variant> variants;
+    QVector<QSharedPointer<QtFMOD::Channel> > channels;
+    QVector<bool> busy;
+    QVector<Voice> voices;
+
+    float minDistance;
+    float maxDistance;
+
+    btVector3 listener;         ///< as of the last update()
+    QElapsedTimer clock;
+
+    Private (QtFMOD::System* fsys) :
+        fsys(fsys),
+        minDistance(150.0f),
+        maxDistance(600.0f),
+        listener(0, 0, 0)
+    {
+        clock.start();
+    }
+
+    float gain (const btVector3& position, const btVector3& listener) const;
+    void realize (Voice& voice, qint64 now);
+    void virtualize (Voice& voice);
+};
+
+VoicePool::VoicePool (QtFMOD::System* fsys, const QString& name,
+                      int channels) :
+    d(new Private(fsys))
+{
+    QDir dir (":media/sfx");
+    QStringList files (dir.entryList(QStringList() << name + "*.oga"));
+    foreach (const QString& file, files) {
+        Variant variant;
+        variant.sound = fsys->createSound(dir.filePath(file), FMOD_3D);
+        if (fsys->error() != FMOD_OK) {
+            qWarning() << Q_FUNC_INFO << fsys->errorString();
+            continue;
+        }
+        variant.length = variant.sound->length(FMOD_TIMEUNIT_MS);
+        d->variants.append(variant);
+    }
+    if (d->variants.isEmpty()) {
+        qWarning() << Q_FUNC_INFO << "no samples for" << name;
+    }
+
+    d->channels.resize(channels);
+    d->busy.fill(false, channels);
+    d->voices.reserve(MAX_VOICES);
+
+    setDistance(d->minDistance, d->maxDistance);
+}
+
+VoicePool::~VoicePool ()
+{
+    for (int i = 0; i < d->channels.size(); i++) {
+        if (d->busy[i]) {
+            d->channels[i]->stop();
+        }
+    }
+}
+
+void VoicePool::setDistance (float minDistance, float maxDistance)
+{
+    d->minDistance = minDistance;
+    d->maxDistance = maxDistance;
+    foreach (const Variant& variant, d->variants) {
+        variant.sound->set3DMinMaxDistance(minDistance, maxDistance);
+    }
+}
+
+/**
+ * Start a voice at @a position.
+ *
+ * It gets a channel on the next update(), if it is audible enough.
+ *
+ * @param[in] delay in milliseconds; negative skips into the sample
+ */
+void VoicePool::play (const btVector3& position, int delay)
+{
+    if (d->variants.isEmpty()) {
+        return;
+    }
+
+    Voice voice;
+    voice.variant = randi(d->variants.size());
+    voice.pitch = randf(MIN_PITCH, MAX_PITCH);
+    voice.position = position;
+    voice.start = d->clock.elapsed() + delay;
+    voice.length = d->variants[voice.variant].length / voice.pitch;
+    voice.audibility = d->gain(position, d->listener);
+    voice.slot = -1;
+
+    if (voice.audibility <= 0.0f) {
+        // out of range
+        return;
+    }
+
+    if (d->voices.size() < MAX_VOICES) {
+        d->voices.append(voice);
+        return;
+    }
+
+    // replace the least audible voice, if it is quieter than this one
+    Voice* quietest = &d->voices.first();
+    for (int i = 1; i < d->voices.size(); i++) {
+        if (d->voices[i].audibility < quietest->audibility) {
+            quietest = &d->voices[i];
+        }
+    }
+    if (quietest->audibility < voice.audibility) {
+        d->virtualize(*quietest);
+        *quietest = voice;
+    }
+}
+
+/**
+ * Re-rank the voices for @a listener, and hand out the channels.
+ */
+void VoicePool::update (const btVector3& listener)
+{
+    d->listener = listener;
+
+    if (d->voices.isEmpty()) {
+        return;
+    }
+
+    qint64 now = d->clock.elapsed();
+
+    // drop finished and out of range voices, rate the rest
+    int n = 0;
+    for (int i = 0; i < d->voices.size(); i++) {
+        Voice& voice = d->voices[i];
+        qint64 age = now - voice.start;
+        float gain = d->gain(voice.position, listener);
+        if (age >= voice.length || gain <= 0.0f) {
+            d->virtualize(voice);
+            continue;
+        }
+        voice.audibility = gain
+            * (1.0f - float(qMax(age, qint64(0))) / voice.length);
+        d->voices[n++] = voice;
+    }
+    d->voices.resize(n);
+
+    qStableSort(d->voices.begin(), d->voices.end(), moreAudible);
+
+    // the pool's worth of loudest voices are real
+    int channels = d->channels.size();
+    for (int i = channels; i < d->voices.size(); i++) {
+        d->virtualize(d->voices[i]);
+    }
+    for (int i = 0; i < qMin(channels, d->voices.size()); i++) {
+        if (d->voices[i].slot < 0 && d->voices[i].start <= now) {
+            d->realize(d->voices[i], now);
+        }
+    }
+}
+
+int VoicePool::realVoices () const
+{
+    return d->busy.count(true);
+}
+
+int VoicePool::virtualVoices () const
+{
+    return d->voices.size() - realVoices();
+}
+
+/**
+ * Inverse distance rolloff, as FMOD applies it, cut off at maxDistance.
+ */
+float VoicePool::Private::gain (const btVector3& position,
+                                const btVector3& listener) const
+{
+    float distance = position.distance(listener);
+    if (distance >= maxDistance) {
+        return 0.0f;
+    }
+    if (distance <= minDistance) {
+        return 1.0f;
+    }
+    return minDistance / distance;
+}
+
+/**
+ * Give @a voice a free channel, starting the sample where the voice is at.
+ */
+void VoicePool::Private::realize (Voice& voice, qint64 now)
+{
+    int slot = busy.indexOf(false);
+    if (slot < 0) {
+        return;
+    }
+
+    QSharedPointer<QtFMOD::Channel>& channel (channels[slot]);
+    fsys->playSound(FMOD_CHANNEL_REUSE, variants[voice.variant].sound, true,
+                    channel);
+    if (fsys->error() != FMOD_OK || !channel) {
+        qWarning() << Q_FUNC_INFO << fsys->errorString();
+        return;
+    }
+
+    channel->setFrequency(channel->frequency() * voice.pitch);
+    channel->set3DAttributes(voice.position);
+    quint32 age = now - voice.start;
+    if (age > 0) {
+        channel->setPosition(age * voice.pitch, FMOD_TIMEUNIT_MS);
+    }
+    channel->setPaused(false);
+
+    busy[slot] = true;
+    voice.slot = slot;
+}
+
+/**
+ * Take the channel away from @a voice, if it has one.
+ */
+void VoicePool::Private::virtualize (Voice& voice)
+{
+    if (voice.slot < 0) {
+        return;
+    }
+    channels[voice.slot]->stop();
+    busy[voice.slot] = false;
+    voice.slot = -1;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file VoicePool.h
+ * @brief VoicePool definition
+ */
+
+#pragma once
+
+#include <QString>
+#include <QScopedPointer>
+
+class btVector3;
+
+namespace QtFMOD
+{
+class System;
+}
+
+class VoicePool
+{
+public:
+    VoicePool (QtFMOD::System* fsys, const QString& name, int channels);
+    virtual ~VoicePool ();
+
+    void setDistance (float minDistance, float maxDistance);
+
+    void play (const btVector3& position, int delay = 0);
+    void update (const btVector3& listener);
+
+    int realVoices () const;
+    int virtualVoices () const;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
@@ -0,0 +1,221 @@
+
+/**
+ * @file analyze.cpp
+ * @brief headless analyzer runner
+ *
+ * Decodes tracks with FMOD's non-realtime output and feeds them through the
+ * same spectrum smoothing and analyzer script as the player, as fast as the
+ * CPU allows.  Prints the launch timeline and per-stage timings as JSON.
+ *
+ * @code
+ * fyreware-analyze [-a analyzer] [-s seed] file...
+ * @endcode
+ */
+
+#include "defs.h"
+#include "scripting.h"
+#include "Analysis.h"
+#include "FeatureGraph.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScriptEngine>
+#include <QStringList>
+#include <QTextStream>
+#include <QDebug>
+
+struct Timings : HopTimings
+{
+    qint64 script;
+
+    Timings () :
+        script(0)
+    {
+    }
+};
+
+static
+QScriptValue launchFun (QScriptContext* ctx, QScriptEngine* eng)
+{
+    Q_UNUSED(eng);
+    QScriptValue launches = ctx->callee().data();
+    launches.setProperty(launches.property("length").toUInt32(),
+                         ctx->callee().property("time"));
+    return QScriptValue();
+}
+
+static
+QString jsonString (const QString& str)
+{
+    QString out ("\"");
+    foreach (const QChar& c, str) {
+        switch (c.unicode()) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c.unicode() < 0x20) {
+                out += QString("\\u%0").arg(c.unicode(), 4, 16, QChar('0'));
+            } else {
+                out += c;
+            }
+            break;
+        }
+    }
+    out += "\"";
+    return out;
+}
+
+static inline
+qreal ms (qint64 nsecs)
+{
+    return nsecs * 1e-6;
+}
+
+/**
+ * Analyze one track into a JSON object.
+ */
+static
+bool analyze (QString& json, const QString& path,
+              QScriptEngine& engine, const QScriptProgram& analyzer)
+{
+    QElapsedTimer wall;
+    wall.start();
+
+    HopDecoder decoder (path);
+    if (!decoder.isOpen()) {
+        return false;
+    }
+    FeatureGraph features;
+
+    QScriptValue launches = engine.newArray();
+    QScriptValue launch = engine.newFunction(launchFun);
+    launch.setData(launches);
+
+    Timings timings;
+    QElapsedTimer t;
+    int frames = 0;
+
+    while (decoder.next(&timings)) {
+        const AnalysisFrame& frame (decoder.frame());
+
+        t.start();
+        features.beginHop(frame.spectrum, frame.time);
+        timings.smooth += t.nsecsElapsed();
+
+        t.start();
+        QScriptContext* ctx = engine.pushContext();
+        QScriptValue ao = ctx->activationObject();
+        prepGlobalObject(&engine, ao, &features);
+        launch.setProperty("time", frame.time);
+        ao.setProperty("launch", launch);
+        engine.evaluate(analyzer);
+        engine.popContext();
+        timings.script += t.nsecsElapsed();
+
+        if (engine.hasUncaughtException()) {
+            qWarning() << path << engine.uncaughtException().toString();
+            engine.clearExceptions();
+        }
+
+        frames++;
+    }
+
+    qint64 elapsed = wall.nsecsElapsed();
+    quint32 duration = decoder.frame().time;
+
+    QTextStream out (&json);
+    out << "{\"file\": " << jsonString(path)
+        << ", \"durationMs\": " << duration
+        << ", \"frames\": " << frames
+        << ", \"wallMs\": " << ms(elapsed)
+        << ", \"realtimeFactor\": "
+        << (elapsed > 0 ? duration / ms(elapsed) : 0.0)
+        << ", \"stagesMs\": {"
+        << "\"decode\": " << ms(timings.decode)
+        << ", \"fft\": " << ms(timings.fft)
+        << ", \"smooth\": " << ms(timings.smooth)
+        << ", \"script\": " << ms(timings.script)
+        << "}, \"launches\": [";
+    quint32 count = launches.property("length").toUInt32();
+    for (quint32 i = 0; i < count; i++) {
+        out << (i ? ", " : "") << launches.property(i).toUInt32();
+    }
+    out << "]}";
+
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+
+    QString analyzerFile ("scripts/default.analyzer");
+    uint seed = 1;
+    QStringList files;
+
+    QStringList args (app.arguments());
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i] == "-a" && i + 1 < args.size()) {
+            analyzerFile = args[++i];
+        } else if (args[i] == "-s" && i + 1 < args.size()) {
+            seed = args[++i].toUInt();
+        } else {
+            files << args[i];
+        }
+    }
+
+    if (files.isEmpty()) {
+        qCritical("usage: %s [-a analyzer] [-s seed] file...",
+                  qPrintable(args[0]));
+        return 1;
+    }
+
+    QFile dev (analyzerFile);
+    if (!dev.open(QIODevice::ReadOnly)) {
+        qCritical() << analyzerFile << dev.errorString();
+        return 1;
+    }
+    QScriptProgram analyzer (dev.readAll(), dev.fileName());
+    dev.close();
+
+    QScriptEngine engine;
+    QTextStream out (stdout);
+
+    out << "{\"analyzer\": " << jsonString(analyzerFile)
+        << ", \"seed\": " << seed
+        << ", \"tracks\": [\n";
+
+    bool first = true;
+    int failures = 0;
+    foreach (const QString& file, files) {
+        // same launches for the same input, across runs
+        qsrand(seed);
+
+        QString json;
+        if (!analyze(json, file, engine, analyzer)) {
+            failures++;
+            continue;
+        }
+        if (!first) {
+            out << ",\n";
+        }
+        out << json;
+        out.flush();
+        first = false;
+    }
+
+    out << "\n]}\n";
+
+    return failures ? 2 : 0;
+}
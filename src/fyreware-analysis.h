@@ -0,0 +1,145 @@
+/*
+ * Copyright 2010 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fyreware-analysis.h
+ * @brief layout of the shared analysis segment, for external readers
+ *
+ * FyreWare writes every analysis frame into a POSIX shared memory segment
+ * named FYREWARE_SHM_NAME.  Readers map it read-only and copy frames out
+ * with fyreware_shm_read(), which retries while a write is in progress:
+ *
+ * @code
+ * struct fyreware_shm* shm = fyreware_shm_open();
+ * struct fyreware_frame frame;
+ * if (shm && fyreware_shm_read(shm, &frame)) {
+ *     ... frame.bands[0][0], frame.beat_phase ...
+ * }
+ * @endcode
+ *
+ * Plain C, so lighting and LED drivers can include it as is.  Link with
+ * -lrt on older glibc.
+ */
+
+#ifndef FYREWARE_ANALYSIS_H
+#define FYREWARE_ANALYSIS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FYREWARE_SHM_NAME "/fyreware-analysis"
+#define FYREWARE_SHM_MAGIC 0x48535746u     /* "FWSH" */
+#define FYREWARE_SHM_VERSION 1
+
+#define FYREWARE_SHM_SPECTRUM 256          /* bins per channel */
+#define FYREWARE_SHM_BANDS 32              /* log-spaced bands per channel */
+
+/**
+ * One analysis frame.
+ */
+struct fyreware_frame
+{
+    uint64_t timestamp;         /**< CLOCK_MONOTONIC when written, in ns */
+    uint32_t frame;             /**< counts analysis frames */
+    uint32_t track_time;        /**< playback position, in ms */
+
+    float spectrum[2][FYREWARE_SHM_SPECTRUM];  /**< smoothed, per channel */
+    float bands[2][FYREWARE_SHM_BANDS];        /**< peak per band */
+
+    float loudness;             /**< summed spectrum of both channels */
+    float flux;                 /**< onset strength */
+    uint32_t onset;             /**< nonzero on an onset */
+
+    float beat_period;          /**< in ms, 0 if unknown */
+    float beat_phase;           /**< 0 on the beat, up to 1 */
+    uint32_t reserved[7];
+};
+
+/**
+ * The whole segment.
+ */
+struct fyreware_shm
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              /**< sizeof(struct fyreware_shm) */
+    volatile uint32_t sequence; /**< odd while frame is being written */
+    struct fyreware_frame frame;
+};
+
+/**
+ * Map the segment read-only.
+ *
+ * @return NULL if FyreWare is not running, or speaks another version
+ */
+static inline struct fyreware_shm* fyreware_shm_open (void)
+{
+    struct fyreware_shm* shm;
+    struct stat st;
+    int fd = shm_open(FYREWARE_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    /* still being set up, or not ours: touching it past the end faults */
+    if (fstat(fd, &st) < 0
+        || st.st_size < (off_t)sizeof(struct fyreware_shm)) {
+        close(fd);
+        return NULL;
+    }
+    shm = (struct fyreware_shm*)mmap(NULL, sizeof(struct fyreware_shm),
+                                     PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+    if (shm->magic != FYREWARE_SHM_MAGIC
+        || shm->version != FYREWARE_SHM_VERSION
+        || shm->size != sizeof(struct fyreware_shm)) {
+        munmap(shm, sizeof(struct fyreware_shm));
+        return NULL;
+    }
+    return shm;
+}
+
+static inline void fyreware_shm_close (struct fyreware_shm* shm)
+{
+    munmap(shm, sizeof(struct fyreware_shm));
+}
+
+/**
+ * Copy out the newest frame.
+ *
+ * @return 0 if nothing has been written yet
+ */
+static inline int fyreware_shm_read (const struct fyreware_shm* shm,
+                                     struct fyreware_frame* out)
+{
+    uint32_t begin, end;
+    do {
+        begin = shm->sequence;
+        __sync_synchronize();
+        memcpy(out, &shm->frame, sizeof(*out));
+        __sync_synchronize();
+        end = shm->sequence;
+    } while (begin != end || (begin & 1));
+    return begin != 0;
+}
+
+#endif /* FYREWARE_ANALYSIS_H */
@@ -0,0 +1,137 @@
+/**
+ * @file gldebug.cpp
+ * @brief gldebug implementation
+ *
+ * In debug builds the driver reports errors, and what it thinks of our
+ * performance, through a KHR_debug or ARB_debug_output callback.  In a
+ * debug context nothing is read back from the pipeline to find out.
+ * Release builds leave the debug output off.
+ */
+
+#include "gldebug.h"
+
+#include "defs.h"
+
+#include <QDebug>
+
+static bool debugOutput = false;
+
+#ifndef QT_NO_DEBUG
+
+static
+const char* sourceName (GLenum source)
+{
+    switch (source) {
+    case GL_DEBUG_SOURCE_API:
+        return "api";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+        return "window system";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER:
+        return "shader compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:
+        return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:
+        return "application";
+    default:
+        return "other";
+    }
+}
+
+static
+const char* typeName (GLenum type)
+{
+    switch (type) {
+    case GL_DEBUG_TYPE_ERROR:
+        return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:
+        return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        return "performance";
+    default:
+        return "other";
+    }
+}
+
+/**
+ * Called synchronously, from inside the call that caused it.
+ */
+static
+void APIENTRY debugCallback (GLenum source, GLenum type, GLuint id,
+                             GLenum severity, GLsizei length,
+                             const GLchar* message, const void* userParam)
+{
+    Q_UNUSED(length);
+    Q_UNUSED(userParam);
+
+    QString text (QString("OpenGL %0 %1 [%2]: %3")
+                  .arg(sourceName(source))
+                  .arg(typeName(type))
+                  .arg(id)
+                  .arg(message));
+
+    if (type == GL_DEBUG_TYPE_ERROR || severity == GL_DEBUG_SEVERITY_HIGH) {
+        qCritical() << text;
+    } else if (severity == GL_DEBUG_SEVERITY_MEDIUM) {
+        qWarning() << text;
+    } else {
+        qDebug() << text;
+    }
+}
+
+#endif
+
+/**
+ * Route the debug output of the current context to the log.
+ *
+ * Prefers KHR_debug, falls back to ARB_debug_output, and leaves glCheck()
+ * to glGetError() without either.  Notifications are not asked for.  The
+ * output is made synchronous, so a message is logged before the call that
+ * caused it returns.
+ *
+ * Only a debug context is bound to report every error, others may drop
+ * messages at will; so without one glCheck() keeps to glGetError(), and
+ * the callback only adds to it.
+ *
+ * @warning after glewInit(), with the context current
+ */
+void initGLDebug ()
+{
+#ifndef QT_NO_DEBUG
+    bool callback = false;
+    if (GLEW_KHR_debug) {
+        glDebugMessageCallback((GLDEBUGPROC)debugCallback, NULL);
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE,
+                              GL_DEBUG_SEVERITY_NOTIFICATION,
+                              0, NULL, GL_FALSE);
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        callback = true;
+    } else if (GLEW_ARB_debug_output) {
+        glDebugMessageCallbackARB((GLDEBUGPROCARB)debugCallback, NULL);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+        callback = true;
+    }
+
+    GLint flags = 0;
+    if (GLEW_VERSION_3_0) {
+        glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+    }
+    debugOutput = callback && (flags & GL_CONTEXT_FLAG_DEBUG_BIT);
+
+    qDebug() << Q_FUNC_INFO << "debug output"
+             << (!callback ? "not available"
+                 : debugOutput ? "on" : "on, but not a debug context");
+#endif
+}
+
+/**
+ * Whether the driver reports every error through the debug output.
+ */
+bool hasGLDebug ()
+{
+    return debugOutput;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file gldebug.h
+ * @brief gldebug definition
+ */
+
+#pragma once
+
+#include <QtGlobal>
+
+void initGLDebug ();
+bool hasGLDebug ();
+
+/**
+ * Die on a pending OpenGL error.
+ *
+ * Compiled out of release builds, and does nothing where the debug output
+ * reports errors already, as glGetError() stalls the pipeline.
+ */
+#ifdef QT_NO_DEBUG
+#define glCheck() do { } while (0)
+#else
+#define glCheck()                                                           \
+    do {                                                                    \
+        if (hasGLDebug()) {                                                 \
+            break;                                                          \
+        }                                                                   \
+        GLuint gl_error = glGetError();                                     \
+        if (gl_error != GL_NO_ERROR) {                                      \
+            qFatal("OpenGL Error [%s:%d]: %s\n",                            \
+                   Q_FUNC_INFO, __LINE__, gluErrorString(gl_error));        \
+        }                                                                   \
+    } while (0)
+#endif
@@ -24,6 +24,11 @@
 #include "Scene.h"
 #include "Playlist.h"
 #include "SoundEngine.h"
+#include "ThreadManager.h"
+#include "JobSystem.h"
+#include "Telemetry.h"
+#include "PowerManager.h"
+#include "FeatureExtractor.h"
 
 #include "ui/ControlDialog.h"
 
@@ -37,8 +42,11 @@
 #include <QDateTime>
 #include <QDialog>
 #include <QMainWindow>
+#include <QSettings>
+#include <QThreadPool>
 
 #include "ui/GraphicsView.h"
+#include "ui/RenderWidget.h"
 
 #include <QGraphicsProxyWidget>
 #include <QGraphicsTextItem>
@@ -75,6 +83,8 @@ QIcon makeFireIcon ()
 
 int main(int argc, char *argv[])
 {
+    // before the first X connection, in case a render thread draws text
+    QApplication::setAttribute(Qt::AA_X11InitThreads);
     QApplication app (argc, argv);
 
     // randomness
@@ -84,23 +94,54 @@ int main(int argc, char *argv[])
     app.setOrganizationName("MentalDistortion");
     app.setApplicationName("FyreWare");
 
+    QStringList args (app.arguments());
+
+    // --render-thread draws on a thread of its own, away from the widgets
+    bool renderThread = args.contains("--render-thread")
+        || QSettings().value("render/thread", false).toBool();
+
+    ThreadManager threadManager;
+    // the gui thread renders, unless the render thread does
+    threadManager.enter(renderThread ? WorkerRole : RenderRole, "gui");
+    JobSystem jobSystem;
+    Telemetry telemetry;
+    PowerManager powerManager;
+
     SoundEngine soundEngine;
 
     QApplication::setWindowIcon(makeFireIcon());
 
-    QGLWidget* glWidget = new QGLWidget();
-    glWidget->makeCurrent();
+    Scene* scene;
+    QWidget* window;
+    QScopedPointer<GraphicsView> view;
+    QScopedPointer<RenderWidget> renderWidget;
+
+    if (renderThread) {
+        renderWidget.reset(new RenderWidget);
+        renderWidget->makeCurrent();
 
-    glewInit();
+        glewInit();
 
-    Scene* scene = new Scene;
+        scene = new Scene(renderWidget.data());
+        window = renderWidget.data();
+    } else {
+        QGLFormat format;
+        format.setSwapInterval(1);
+        QGLWidget* glWidget = new QGLWidget(format);
+        glWidget->makeCurrent();
 
-    QScopedPointer<GraphicsView> view (new GraphicsView(scene));
-    scene->setParent(view.data());
-    view->setViewport(glWidget);
-    view->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
-    view->resize(900, 600);
-    view->show();
+        glewInit();
+
+        scene = new Scene;
+
+        view.reset(new GraphicsView(scene));
+        scene->setParent(view.data());
+        view->setViewport(glWidget);
+        view->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+        window = view.data();
+    }
+    window->resize(900, 600);
+    window->show();
 
     // splash image
     QSplashScreen* splash;
@@ -108,16 +149,20 @@ int main(int argc, char *argv[])
     QPixmap splashPixmap (":media/images/splash.png");
 
     splashPixmap = splashPixmap.scaled(
-        splashPixmap.size().boundedTo(view->size()),
+        splashPixmap.size().boundedTo(window->size()),
         Qt::KeepAspectRatio,
         Qt::SmoothTransformation
         );
 
     splash = new QSplashScreen(splashPixmap);
-    QGraphicsProxyWidget* splashItem = scene->addWidget(splash);
+    if (renderThread) {
+        splash->show();
+    } else {
+        QGraphicsProxyWidget* splashItem = scene->addWidget(splash);
 
-    QSize diff ((view->size() - splash->size()) / 2);
-    splashItem->setPos(diff.width(), diff.height());
+        QSize diff ((view->size() - splash->size()) / 2);
+        splashItem->setPos(diff.width(), diff.height());
+    }
 
     QObject::connect(
         scene, SIGNAL(statusMessage(const QString&, int, const QColor&)),
@@ -127,21 +172,44 @@ int main(int argc, char *argv[])
     scene->start();
     splash->deleteLater();
 
-    ControlDialog* control = new ControlDialog(view.data());
-
-#if 0
-    // display control dialog as an external window
-    control->show();
-#else
-    // display control dialog within the scene
-    QGraphicsProxyWidget* controlItem
-        = scene->addWidget(control, Qt::Window);
-    // sometimes, the title bar gets hidden, which leaves me no way to move it
-    controlItem->setPos(
-        view->size().width() - control->size().width(),
-        view->size().height() - control->size().height()
-        );
-#endif
+    powerManager.watch(window);
+    QObject::connect(&powerManager, SIGNAL(stateChanged(PowerState)),
+                     scene, SLOT(setPowerState(PowerState)));
+    QObject::connect(&powerManager, SIGNAL(stateChanged(PowerState)),
+                     &soundEngine, SLOT(setPowerState(PowerState)));
+    if (renderThread) {
+        QObject::connect(&powerManager, SIGNAL(stateChanged(PowerState)),
+                         renderWidget.data(), SLOT(setPowerState(PowerState)));
+        renderWidget->startRendering(scene);
+    }
+
+    // --capture [file.wav] analyzes live input instead of the playlist
+    int captureArg = args.indexOf("--capture");
+    if (captureArg >= 0) {
+        QString source;
+        if (captureArg + 1 < args.size()
+            && !args[captureArg + 1].startsWith("-")) {
+            source = args[captureArg + 1];
+        }
+        soundEngine.capture(source);
+    }
+
+    ControlDialog* control = new ControlDialog(window);
+
+    if (renderThread) {
+        // display control dialog as an external window
+        control->show();
+    } else {
+        // display control dialog within the scene
+        QGraphicsProxyWidget* controlItem
+            = scene->addWidget(control, Qt::Window);
+        // sometimes, the title bar gets hidden, which leaves me no way to
+        // move it
+        controlItem->setPos(
+            view->size().width() - control->size().width(),
+            view->size().height() - control->size().height()
+            );
+    }
 
 
     foreach (QGraphicsItem* item, scene->items()) {
@@ -150,5 +218,14 @@ int main(int argc, char *argv[])
         item->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
     }
 
-    return app.exec();
+    int status = app.exec();
+
+    // the scanner pool outlives the widgets its jobs were queued from
+    FeatureExtractor::abort();
+    threadManager.pool(ScannerRole)->waitForDone();
+
+    threadManager.report();
+    jobSystem.report();
+    powerManager.report();
+    return status;
 }
@@ -7,8 +7,7 @@
 #include "scripting.h"
 
 #include "defs.h"
-#include "Scene.h"
-#include "SoundEngine.h"
+#include "FeatureGraph.h"
 
 #include <QScriptEngine>
 
@@ -90,38 +89,20 @@ QScriptValue addFun (QScriptContext* ctx, QScriptEngine* eng)
 }
 
 
-void prepGlobalObject (QScriptValue& sv)
+/**
+ * @param[in] engine the engine @a sv belongs to
+ * @param[in,out] sv the object to populate
+ * @param[in] features the analysis features to expose, computed on access
+ */
+void prepGlobalObject (QScriptEngine* engine, QScriptValue& sv,
+                       FeatureGraph* features)
 {
-    QScriptEngine* engine = scene->scriptEngine();
-
     sv.setProperty("rand" , engine->newFunction(randFun ));
     sv.setProperty("cross", engine->newFunction(crossFun));
     sv.setProperty("add", engine->newFunction(addFun));
 
-    // spectrum
-    QScriptValue spectrumSv  = engine->newArray(2);
-    QScriptValue spectrum0Sv = engine->newArray(soundEngine->spectrumLength());
-    QScriptValue spectrum1Sv = engine->newArray(soundEngine->spectrumLength());
-    spectrumSv.setProperty(0, spectrum0Sv);
-    spectrumSv.setProperty(1, spectrum1Sv);
-
-#if 0
-    for (int i = 0; i < soundEngine->spectrumLength(); i++) {
-        spectrum0Sv.setProperty(i, soundEngine->spectrum(0)[i]);
-        spectrum1Sv.setProperty(i, soundEngine->spectrum(1)[i]);
-    }
-#else
-    const float* array0 = soundEngine->spectrum(0).data();
-    const float* array1 = soundEngine->spectrum(1).data();
-    for (int i = 0; i < soundEngine->spectrumLength(); i++) {
-        spectrum0Sv.setProperty(i, *array0);
-        spectrum1Sv.setProperty(i, *array1);
-        array0++;
-        array1++;
-    }
-#endif
-
-    sv.setProperty("spectrum", spectrumSv);
+    // spectrum, bands, loudness, flux, onset
+    features->expose(engine, sv);
 
     // types
     qScriptRegisterMetaType(engine, btVector3ToScriptValue,
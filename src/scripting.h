@@ -6,6 +6,9 @@
 
 #pragma once
 
+class QScriptEngine;
 class QScriptValue;
+class FeatureGraph;
 
-void prepGlobalObject (QScriptValue& sv);
+void prepGlobalObject (QScriptEngine* engine, QScriptValue& sv,
+                       FeatureGraph* features);
@@ -9,6 +9,9 @@
 #include "defs.h"
 #include "../SoundEngine.h"
 #include "../Playlist.h"
+#include "../FeatureExtractor.h"
+#include "../MappedFile.h"
+#include "../ThreadManager.h"
 
 #include <QtFMOD/System.h>
 #include <QtFMOD/Sound.h>
@@ -76,6 +79,7 @@ void DirectoryScanner::run ()
 {
     d->fsys.reset(new QtFMOD::System);
     d->fsys->setOutput(FMOD_OUTPUTTYPE_NOSOUND);
+    useMappedFiles(d->fsys.data(), RandomAccess);
     d->fsys->init(1);
 
     QString connectionName ("DirectoryScanner%0");
@@ -92,11 +96,14 @@ void DirectoryScanner::run ()
                           QDirIterator::Subdirectories);
         while (dit.hasNext()) {
             dit.next();
-            if (!db.isOpen()) {
+            if (!db.isOpen() || FeatureExtractor::isAborted()) {
                 break;
             }
             scanFile(dit.filePath());
         }
+        if (FeatureExtractor::isEnabled() && !FeatureExtractor::isAborted()) {
+            extractFeatures();
+        }
         db.close();
     }
     QSqlDatabase::removeDatabase(connectionName);
@@ -192,7 +199,8 @@ void DirectoryScanner::scanFile (const QString& path)
                 "album = :album, "
                 "title = :title, "
                 "artist = :artist, "
-                "updatedAt = :updatedAt "
+                "updatedAt = :updatedAt, "
+                "analyzedAt = null "
                 "where url = :url "
                 );
             break;
@@ -220,3 +228,27 @@ void DirectoryScanner::scanFile (const QString& path)
         }
     }
 }
+
+/**
+ * Queue a FeatureExtractor for every local track not analyzed yet.
+ *
+ * Once per scan, after it, so new and changed tracks are queued exactly once
+ * along with those scanned before extraction was enabled.
+ *
+ * @warning Designed to run in separate thread.
+ */
+void DirectoryScanner::extractFeatures ()
+{
+    QSqlQuery q (*d->db);
+    q.prepare("select url from streams where analyzedAt is null "
+              "and url not like 'http%'");
+    if (!q.exec()) {
+        qWarning() << Q_FUNC_INFO << __LINE__ << q.lastError();
+        return;
+    }
+    while (q.next()) {
+        QUrl url (q.value(0).toString());
+        threadManager->start(
+            new FeatureExtractor(url, *d->db), ScannerRole, -1);
+    }
+}
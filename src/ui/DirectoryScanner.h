@@ -30,6 +30,7 @@ signals:
 
 protected:
     void scanFile (const QString& path);
+    void extractFeatures ();
 
 private:
     struct Private;
@@ -10,16 +10,17 @@
 
 #include "../Playlist.h"
 #include "../SoundEngine.h"
+#include "../Telemetry.h"
 #include "PlaylistWidget.h"
 
-#include <QtFMOD/Channel.h>
-#include <QtFMOD/Sound.h>
-
 #include <QSvgRenderer>
 #include <QPainter>
 #include <QImage>
 
-using namespace QtFMOD;
+/**
+ * How often the player shows what the sound engine posted, in milliseconds.
+ */
+#define PLAYER_UPDATE_INTERVAL 100
 
 struct Player::Private
 {
@@ -29,6 +30,9 @@ struct Player::Private
     QIcon pauseIcon;
 
     QSvgRenderer renderer;
+
+    QVariantHash values;        ///< as posted to the telemetry
+
     Private (Player* q) //:
     {
         Q_UNUSED(q);
@@ -64,7 +68,13 @@ Player::Player (QWidget* parent) :
     nextButton->setIcon(d->nextIcon);
     playButton->setIcon(d->playIcon);
 
-    startTimer(100);
+    if (telemetry) {
+        telemetry->subscribe(this, "showTelemetry", PLAYER_UPDATE_INTERVAL,
+                             QStringList()
+                             << "player/playing" << "player/paused"
+                             << "player/position" << "player/length"
+                             << "player/volume" << "player/streamBuffer");
+    }
 
     connect(prevButton, SIGNAL(pressed()), soundEngine, SLOT(prev()));
     connect(nextButton, SIGNAL(pressed()), soundEngine, SLOT(next()));
@@ -95,14 +105,14 @@ QString timeToString (int msecs)
     return timeString;
 }
 
-void Player::timerEvent (QTimerEvent* evt)
+void Player::showTelemetry (const QVariantHash& changes)
 {
-    Q_UNUSED(evt);
-
-    QSharedPointer<Sound> stream (soundEngine->stream());
-    QSharedPointer<Channel> channel (soundEngine->streamChannel());
+    QVariantHash::const_iterator it;
+    for (it = changes.constBegin(); it != changes.constEnd(); ++it) {
+        d->values.insert(it.key(), it.value());
+    }
 
-    if (!channel || !stream) {
+    if (!d->values.value("player/playing").toBool()) {
         timeSlider->setValue(0);
         //volumeSlider->setValue(0);
         playButton->setIcon(d->playIcon);
@@ -112,19 +122,19 @@ void Player::timerEvent (QTimerEvent* evt)
     }
 
     // volume
-    if (channel->isPlaying()) {
-        volumeSlider->setValue(channel->volume() * 100);
-    }
+    volumeSlider->setValue(d->values.value("player/volume").toReal() * 100);
 
     // time
-    unsigned int pos = channel->position(FMOD_TIMEUNIT_MS);
-    unsigned int len = stream->length(FMOD_TIMEUNIT_MS);
+    unsigned int pos = d->values.value("player/position").toUInt();
+    unsigned int len = d->values.value("player/length").toUInt();
 
     if (len == 0xffffffff) {
         // probably a radio stream
         timeSlider->setValue(0);
         timeLabel->setText(timeToString(pos));
-        timeRemainingLabel->setText(QString());
+        timeRemainingLabel->setText(
+            tr("%0% buffered").arg(
+                d->values.value("player/streamBuffer").toInt()));
     } else {
         qreal nt = qreal(pos) / qreal(len);  // the normalized position
 
@@ -136,7 +146,7 @@ void Player::timerEvent (QTimerEvent* evt)
     }
 
     // icons
-    if (!channel->isPlaying() || channel->paused()) {
+    if (d->values.value("player/paused").toBool()) {
         playButton->setIcon(d->playIcon);
     } else {
         playButton->setIcon(d->pauseIcon);
@@ -145,18 +155,12 @@ void Player::timerEvent (QTimerEvent* evt)
 
 void Player::on_timeSlider_sliderMoved (int value)
 {
-    QSharedPointer<Channel> channel (soundEngine->streamChannel());
-    if (channel) {
-        channel->setPosition(value, FMOD_TIMEUNIT_MS);
-    }
+    soundEngine->seek(value);
 }
 
 void Player::on_volumeSlider_sliderMoved (int value)
 {
-    QSharedPointer<Channel> channel (soundEngine->streamChannel());
-    if (channel) {
-        channel->setVolume(value / 100.0);
-    }
+    soundEngine->setVolume(value / 100.0);
 }
 
 /**
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <QWidget>
+#include <QVariant>
 
 #include "ui_Player.h"
 
@@ -18,10 +19,8 @@ public:
     Player (QWidget* parent = NULL);
     virtual ~Player ();
 
-private:
-    void timerEvent (QTimerEvent* evt);
-
 private slots:
+    void showTelemetry (const QVariantHash& changes);
     void on_timeSlider_sliderMoved (int value);
     void on_volumeSlider_sliderMoved (int value);
     void on_timeSlider_sliderPressed ();
@@ -14,13 +14,13 @@
 #include "defs.h"
 #include "PlaylistModel.h"
 #include "DirectoryScanner.h"
+#include "ThreadManager.h"
 
 #include <QDebug>
 #include <QDragEnterEvent>
 #include <QDir>
 #include <QDesktopServices>
 #include <QSortFilterProxyModel>
-#include <QThreadPool>
 
 #include <QSqlDatabase>
 #include <QSqlRecord>
@@ -76,11 +76,11 @@ void PlaylistWidget::update ()
         }
     }
 
-    QThreadPool::globalInstance()->start(
+    threadManager->start(
         new DirectoryScanner(
             QDesktopServices::storageLocation(
-                QDesktopServices::MusicLocation), d->db));
-
+                QDesktopServices::MusicLocation), d->db),
+        ScannerRole);
 }
 
 void PlaylistWidget::playlist_inserted (int idx)
@@ -97,6 +97,8 @@ void PlaylistWidget::initDb ()
 #if 1
     d->db = QSqlDatabase::addDatabase("QSQLITE");
     d->db.setDatabaseName(dataDir.filePath("fyreware.db"));
+    // scanners and extractors write from several threads
+    d->db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
 #else
     d->db = QSqlDatabase::addDatabase("QPSQL");
     d->db.setHostName("sakura");
@@ -119,9 +121,22 @@ void PlaylistWidget::initDb ()
             "    title varchar,"
             "    artist varchar,"
             "    createdAt timestamp,"
-            "    updatedAt timestamp"
+            "    updatedAt timestamp,"
+            "    bpm real,"
+            "    loudness real,"
+            "    replayGain real,"
+            "    onsetDensity real,"
+            "    analyzedAt timestamp"
             ")"
             );
+    } else if (!record.contains("analyzedAt")) {
+        // features added after the fact
+        QSqlQuery q;
+        q.exec("alter table streams add column bpm real");
+        q.exec("alter table streams add column loudness real");
+        q.exec("alter table streams add column replayGain real");
+        q.exec("alter table streams add column onsetDensity real");
+        q.exec("alter table streams add column analyzedAt timestamp");
     }
 }
 
@@ -0,0 +1,176 @@
+/**
+ * @file RenderWidget.cpp
+ * @brief RenderWidget implementation
+ */
+
+#include "RenderWidget.moc"
+
+#include "Scene.h"
+#include "OrbitalCamera.h"
+#include "RenderThread.h"
+
+#include <QResizeEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QSettings>
+#include <QDebug>
+
+/**
+ * @class RenderWidget
+ *
+ * @brief the scene's window when a RenderThread draws it
+ *
+ * Once startRendering() was called the context belongs to the render
+ * thread, so painting and resizing never touch it here.  Mouse input still
+ * arrives on the GUI thread and steers the camera as in GraphicsView.
+ */
+
+static
+QGLFormat renderFormat ()
+{
+    QGLFormat format;
+    format.setSwapInterval(1);
+    return format;
+}
+
+struct RenderWidget::Private
+{
+    QSettings* settings;
+    RenderThread* thread;
+
+    QPoint lastPos;
+
+    Private (RenderWidget* q) :
+        settings(new QSettings(q)),
+        thread(NULL)
+    {
+    }
+};
+
+RenderWidget::RenderWidget (QWidget* parent) :
+    QGLWidget(renderFormat(), parent),
+    d(new Private(this))
+{
+    setWindowTitle(tr("Fyreware"));
+    setAutoBufferSwap(false);
+    setAttribute(Qt::WA_PaintOutsidePaintEvent);
+}
+
+/**
+ * The context goes with this widget, so the render thread has to be done
+ * with it first.
+ */
+RenderWidget::~RenderWidget ()
+{
+    if (d->thread) {
+        d->thread->stop();
+        d->thread->wait();
+    }
+}
+
+/**
+ * Hand the context over to a render thread drawing @a scene.
+ *
+ * @warning with the context current on the calling thread
+ */
+void RenderWidget::startRendering (Scene* scene)
+{
+    Q_ASSERT(!d->thread);
+
+    doneCurrent();
+    scene->setRenderThreaded(true);
+    d->thread = new RenderThread(scene, this, this);
+    if (powerManager) {
+        d->thread->setPowerState(powerManager->state());
+    }
+    d->thread->start();
+}
+
+void RenderWidget::setPowerState (PowerState state)
+{
+    if (d->thread) {
+        d->thread->setPowerState(state);
+    }
+}
+
+void RenderWidget::paintEvent (QPaintEvent* evt)
+{
+    Q_UNUSED(evt);
+}
+
+void RenderWidget::resizeEvent (QResizeEvent* evt)
+{
+    if (d->thread) {
+        d->thread->resize(evt->size());
+    }
+}
+
+void RenderWidget::showEvent (QShowEvent* evt)
+{
+    Q_UNUSED(evt);
+
+    resize(d->settings->value("scene/size", QSize(600, 400)).toSize());
+    if (d->settings->contains("scene/pos")) {
+        move(d->settings->value("scene/pos").toPoint());
+    }
+
+    if (d->settings->value("scene/isFullScreen", false).toBool()) {
+        setWindowState(Qt::WindowFullScreen);
+    }
+}
+
+void RenderWidget::closeEvent (QCloseEvent* evt)
+{
+    Q_UNUSED(evt);
+
+    if (isFullScreen()) {
+        d->settings->setValue("scene/isFullScreen", true);
+    } else {
+        d->settings->setValue("scene/size", size());
+        d->settings->setValue("scene/pos", pos());
+    }
+}
+
+void RenderWidget::mousePressEvent (QMouseEvent* evt)
+{
+    d->lastPos = evt->pos();
+    evt->accept();
+}
+
+void RenderWidget::mouseMoveEvent (QMouseEvent* evt)
+{
+    if (d->lastPos == QPoint()) {
+        evt->ignore();
+        return;
+    }
+
+    QPointF delta = evt->pos() - d->lastPos;
+    delta *= ::scene->dt();
+
+    OrbitalCamera* ocam = qobject_cast<OrbitalCamera*>(::scene->camera());
+    if (ocam) {
+        ocam->razimuth()  +=  delta.x();
+        ocam->raltitude() += -delta.y();
+    }
+
+    d->lastPos = evt->pos();
+    evt->accept();
+}
+
+void RenderWidget::mouseReleaseEvent (QMouseEvent* evt)
+{
+    d->lastPos = QPoint();
+    evt->accept();
+}
+
+void RenderWidget::wheelEvent (QWheelEvent* evt)
+{
+    OrbitalCamera* ocam = qobject_cast<OrbitalCamera*>(::scene->camera());
+    Q_ASSERT(ocam);
+
+    if (evt->orientation() == Qt::Vertical) {
+        ocam->rdistance() += evt->delta() * ::scene->dt() * 10;
+    }
+
+    evt->accept();
+}
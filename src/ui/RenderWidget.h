@@ -0,0 +1,42 @@
+/**
+ * @file RenderWidget.h
+ * @brief RenderWidget definition
+ */
+
+#pragma once
+
+#include <QGLWidget>
+
+#include "PowerManager.h"
+
+class Scene;
+
+class RenderWidget : public QGLWidget
+{
+    Q_OBJECT
+
+public:
+    RenderWidget (QWidget* parent = NULL);
+    virtual ~RenderWidget ();
+
+    void startRendering (Scene* scene);
+
+public slots:
+    void setPowerState (PowerState state);
+
+protected:
+    void paintEvent (QPaintEvent* evt);
+    void resizeEvent (QResizeEvent* evt);
+
+    void showEvent (QShowEvent* evt);
+    void closeEvent (QCloseEvent* evt);
+
+    void mousePressEvent (QMouseEvent* evt);
+    void mouseMoveEvent (QMouseEvent* evt);
+    void mouseReleaseEvent (QMouseEvent* evt);
+    void wheelEvent (QWheelEvent* evt);
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};